@@ -4,13 +4,28 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE_TAGS := eng development
-LOCAL_SRC_FILES := main.cpp CameraNativeWindow.cpp
+LOCAL_SRC_FILES := main.cpp CameraNativeWindow.cpp CameraParametersFlat.cpp CameraCapabilities.cpp ImageWriter.cpp RawCompressor.cpp
 LOCAL_MODULE := snapshot
 LOCAL_STATIC_LIBRARIES := libcutils libc
-LOCAL_SHARED_LIBRARIES := libhardware libcamera_client libbinder libui libdl libutils
+LOCAL_SHARED_LIBRARIES := libhardware libcamera_client libbinder libui libdl libutils libz
 LOCAL_CFLAGS := -g -O0
+LOCAL_C_INCLUDES := external/zlib
+# Trace the HAL wrapper into an in-memory ring, see CameraTrace.h
+# LOCAL_CFLAGS += -DCAMERA_TRACE_LEVEL=1
 # LOCAL_LDLIBS := -ldl
 include $(BUILD_EXECUTABLE)
 
+# Host-side CameraNativeWindow load test, using memfd-backed buffers in
+# place of gralloc.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := cnw_bench.cpp CameraNativeWindow.cpp HostGraphicBuffer.cpp
+LOCAL_MODULE := cnw_bench
+LOCAL_STATIC_LIBRARIES := libutils libcutils
+LOCAL_CFLAGS := -O2 -DCNW_HOST_BUFFERS
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
+
 endif  # TARGET_SIMULATOR != true
 
@@ -0,0 +1,529 @@
+#include "CameraCapabilities.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+#include <utils/Log.h>
+#include <utils/threads.h>
+
+using namespace android;
+
+// Capabilities built so far, by camera id.
+static Mutex sCapabilitiesLock;
+static sp<CameraCapabilities> sCapabilities[CameraCapabilities::MAX_CAMERAS];
+
+// The cache file is a CacheHeader followed by header.size bytes of payload,
+// in native byte order since it never leaves the device. The payload starts
+// with the board, camera id and fingerprint it was written for, so a file
+// copied or left over from another build does not match. Bump CACHE_VERSION
+// whenever the payload layout changes.
+enum {
+    CACHE_MAGIC = 0x50414343,   // "CCAP"
+    CACHE_VERSION = 1,
+    // Anything larger is not a capabilities file.
+    CACHE_MAX_SIZE = 256 * 1024
+};
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t checksum;
+};
+
+// FNV-1a, to catch a torn or truncated file.
+static uint32_t checksum(const uint8_t* data, size_t size)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void putInt(String8* out, int32_t value)
+{
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putFloat(String8* out, float value)
+{
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(String8* out, const char* value)
+{
+    size_t length = value ? strlen(value) : 0;
+    putInt(out, length);
+    out->append(value, length);
+}
+
+static void putSizes(String8* out, const Vector<Size>& sizes)
+{
+    putInt(out, sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+        putInt(out, sizes[i].width);
+        putInt(out, sizes[i].height);
+    }
+}
+
+static void putInts(String8* out, const Vector<int>& values)
+{
+    putInt(out, values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        putInt(out, values[i]);
+    }
+}
+
+static void putStrings(String8* out, const Vector<String8>& values)
+{
+    putInt(out, values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        putString(out, values[i].string());
+    }
+}
+
+// CacheReader reads back what the put functions wrote. Any read past the
+// end fails, and so does every read after it.
+class CacheReader
+{
+public:
+    CacheReader(const uint8_t* data, size_t size)
+        : mData(data), mSize(size), mOk(true) { }
+
+    bool ok() const { return mOk; }
+
+    int32_t getInt()
+    {
+        int32_t value = 0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    float getFloat()
+    {
+        float value = 0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    // getCount reads a count of items of at least itemSize bytes each, and
+    // rejects one the rest of the data could not possibly hold.
+    size_t getCount(size_t itemSize)
+    {
+        uint32_t count = getInt();
+        if (!mOk || count > mSize / itemSize) {
+            mOk = false;
+            return 0;
+        }
+        return count;
+    }
+
+    String8 getString()
+    {
+        size_t length = getCount(1);
+        if (!mOk) {
+            return String8();
+        }
+        String8 value(reinterpret_cast<const char*>(mData), length);
+        skip(length);
+        return value;
+    }
+
+    void getSizes(Vector<Size>* sizes)
+    {
+        sizes->clear();
+        for (size_t i = getCount(2 * sizeof(int32_t)); i > 0; i--) {
+            int width = getInt();
+            sizes->push(Size(width, getInt()));
+        }
+    }
+
+    void getInts(Vector<int>* values)
+    {
+        values->clear();
+        for (size_t i = getCount(sizeof(int32_t)); i > 0; i--) {
+            values->push(getInt());
+        }
+    }
+
+    void getStrings(Vector<String8>* values)
+    {
+        values->clear();
+        for (size_t i = getCount(sizeof(int32_t)); i > 0; i--) {
+            values->push(getString());
+        }
+    }
+
+private:
+    void read(void* out, size_t size)
+    {
+        if (mOk && size <= mSize) {
+            memcpy(out, mData, size);
+        }
+        skip(size);
+    }
+
+    void skip(size_t size)
+    {
+        if (!mOk || size > mSize) {
+            mOk = false;
+            return;
+        }
+        mData += size;
+        mSize -= size;
+    }
+
+    const uint8_t* mData;
+    size_t mSize;
+    bool mOk;
+};
+
+
+CameraCapabilities::CameraCapabilities()
+    : mMaxZoom(0),
+      mZoomSupported(false),
+      mSmoothZoomSupported(false),
+      mMinExposure(0),
+      mMaxExposure(0),
+      mExposureStep(0),
+      mMaxFacesHw(0),
+      mMaxFacesSw(0)
+{
+}
+
+CameraCapabilities::~CameraCapabilities()
+{
+}
+
+sp<CameraCapabilities> CameraCapabilities::lookup(int cameraId)
+{
+    if (cameraId < 0 || cameraId >= MAX_CAMERAS) {
+        return 0;
+    }
+    Mutex::Autolock lock(sCapabilitiesLock);
+    return sCapabilities[cameraId];
+}
+
+sp<CameraCapabilities> CameraCapabilities::build(int cameraId,
+        const char* flattened)
+{
+    sp<CameraCapabilities> caps = new CameraCapabilities();
+    FlatCameraParameters params(flattened);
+    caps->parse(params);
+
+    if (cameraId >= 0 && cameraId < MAX_CAMERAS) {
+        Mutex::Autolock lock(sCapabilitiesLock);
+        sCapabilities[cameraId] = caps;
+    }
+    return caps;
+}
+
+void CameraCapabilities::parse(const FlatCameraParameters& p)
+{
+    parseSizes(p.get(CameraParameterKey::KEY_SUPPORTED_PREVIEW_SIZES), &mPreviewSizes);
+    parseSizes(p.get(CameraParameterKey::KEY_SUPPORTED_PICTURE_SIZES), &mPictureSizes);
+    parseSizes(p.get(CameraParameterKey::KEY_SUPPORTED_VIDEO_SIZES), &mVideoSizes);
+    parseSizes(p.get(CameraParameterKey::KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES), &mThumbnailSizes);
+    parseFpsRanges(p.get(CameraParameterKey::KEY_SUPPORTED_PREVIEW_FPS_RANGE), &mPreviewFpsRanges);
+    parseInts(p.get(CameraParameterKey::KEY_SUPPORTED_PREVIEW_FRAME_RATES), &mPreviewFrameRates);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_PREVIEW_FORMATS), &mPreviewFormats);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_PICTURE_FORMATS), &mPictureFormats);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_FOCUS_MODES), &mFocusModes);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_FLASH_MODES), &mFlashModes);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_SCENE_MODES), &mSceneModes);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_WHITE_BALANCE), &mWhiteBalances);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_EFFECTS), &mEffects);
+    parseStrings(p.get(CameraParameterKey::KEY_SUPPORTED_ANTIBANDING), &mAntibanding);
+    parseInts(p.get(CameraParameterKey::KEY_ZOOM_RATIOS), &mZoomRatios);
+
+    const char* v;
+    mZoomSupported = (v = p.get(CameraParameterKey::KEY_ZOOM_SUPPORTED)) && !strcmp(v, "true");
+    mSmoothZoomSupported = (v = p.get(CameraParameterKey::KEY_SMOOTH_ZOOM_SUPPORTED)) && !strcmp(v, "true");
+    mMaxZoom = (v = p.get(CameraParameterKey::KEY_MAX_ZOOM)) ? atoi(v) : 0;
+    mMinExposure = (v = p.get(CameraParameterKey::KEY_MIN_EXPOSURE_COMPENSATION)) ? atoi(v) : 0;
+    mMaxExposure = (v = p.get(CameraParameterKey::KEY_MAX_EXPOSURE_COMPENSATION)) ? atoi(v) : 0;
+    mExposureStep = (v = p.get(CameraParameterKey::KEY_EXPOSURE_COMPENSATION_STEP)) ? strtof(v, 0) : 0;
+    mMaxFacesHw = (v = p.get(CameraParameterKey::KEY_MAX_NUM_DETECTED_FACES_HW)) ? atoi(v) : 0;
+    mMaxFacesSw = (v = p.get(CameraParameterKey::KEY_MAX_NUM_DETECTED_FACES_SW)) ? atoi(v) : 0;
+}
+
+// "640x480,320x240"
+void CameraCapabilities::parseSizes(const char* list, Vector<Size>* sizes)
+{
+    sizes->clear();
+    while (list && *list) {
+        char* end;
+        int width = strtol(list, &end, 10);
+        if (*end != 'x') {
+            return;
+        }
+        int height = strtol(end + 1, &end, 10);
+        sizes->push(Size(width, height));
+        list = *end == ',' ? end + 1 : 0;
+    }
+}
+
+// "(15000,30000),(30000,30000)"
+void CameraCapabilities::parseFpsRanges(const char* list,
+        Vector<FpsRange>* ranges)
+{
+    ranges->clear();
+    while (list && (list = strchr(list, '('))) {
+        char* end;
+        FpsRange range;
+        range.min = strtol(list + 1, &end, 10);
+        if (*end != ',') {
+            return;
+        }
+        range.max = strtol(end + 1, &end, 10);
+        if (*end != ')') {
+            return;
+        }
+        ranges->push(range);
+        list = end + 1;
+    }
+}
+
+// "15,24,30"
+void CameraCapabilities::parseInts(const char* list, Vector<int>* values)
+{
+    values->clear();
+    while (list && *list) {
+        char* end;
+        int value = strtol(list, &end, 10);
+        if (end == list) {
+            return;
+        }
+        values->push(value);
+        list = *end == ',' ? end + 1 : 0;
+    }
+}
+
+// "auto,macro,infinity"
+void CameraCapabilities::parseStrings(const char* list,
+        Vector<String8>* values)
+{
+    values->clear();
+    while (list && *list) {
+        const char* end = strchr(list, ',');
+        if (!end) {
+            values->push(String8(list));
+            return;
+        }
+        values->push(String8(list, end - list));
+        list = end + 1;
+    }
+}
+
+ssize_t CameraCapabilities::closestSize(const Vector<Size>& sizes, int width,
+        int height, uint32_t* delta)
+{
+    ssize_t best = -1;
+    uint32_t bestDelta = 0xffffffff;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        uint32_t d = abs(sizes[i].width * sizes[i].height - width * height);
+        if (d < bestDelta) {
+            bestDelta = d;
+            best = i;
+        }
+    }
+    if (delta) {
+        *delta = bestDelta;
+    }
+    return best;
+}
+
+bool CameraCapabilities::contains(const Vector<String8>& values,
+        const char* value)
+{
+    if (!value) {
+        return false;
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!strcmp(values[i].string(), value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+String8 CameraCapabilities::fingerprint(const hw_module_t* module)
+{
+    char build[PROPERTY_VALUE_MAX];
+    property_get("ro.build.fingerprint", build, "");
+
+    String8 result(build);
+    if (module) {
+        result.appendFormat("|%s|%s|%d.%d", module->name, module->author,
+                module->version_major, module->version_minor);
+    }
+    return result;
+}
+
+String8 CameraCapabilities::cachePath(const char* board, int cameraId)
+{
+    String8 path;
+    path.appendFormat(CAMERA_CAPABILITIES_CACHE_DIR "/camera-caps-%s-%d.bin",
+            board && *board ? board : "unknown", cameraId);
+    return path;
+}
+
+void CameraCapabilities::encode(const char* board, int cameraId,
+        const char* fingerprint, String8* out) const
+{
+    putString(out, board);
+    putInt(out, cameraId);
+    putString(out, fingerprint);
+
+    putSizes(out, mPreviewSizes);
+    putSizes(out, mPictureSizes);
+    putSizes(out, mVideoSizes);
+    putSizes(out, mThumbnailSizes);
+    putInt(out, mPreviewFpsRanges.size());
+    for (size_t i = 0; i < mPreviewFpsRanges.size(); i++) {
+        putInt(out, mPreviewFpsRanges[i].min);
+        putInt(out, mPreviewFpsRanges[i].max);
+    }
+    putInts(out, mPreviewFrameRates);
+    putStrings(out, mPreviewFormats);
+    putStrings(out, mPictureFormats);
+    putStrings(out, mFocusModes);
+    putStrings(out, mFlashModes);
+    putStrings(out, mSceneModes);
+    putStrings(out, mWhiteBalances);
+    putStrings(out, mEffects);
+    putStrings(out, mAntibanding);
+    putInts(out, mZoomRatios);
+    putInt(out, mMaxZoom);
+    putInt(out, mZoomSupported);
+    putInt(out, mSmoothZoomSupported);
+    putInt(out, mMinExposure);
+    putInt(out, mMaxExposure);
+    putFloat(out, mExposureStep);
+    putInt(out, mMaxFacesHw);
+    putInt(out, mMaxFacesSw);
+}
+
+bool CameraCapabilities::decode(const char* board, int cameraId,
+        const char* fingerprint, const uint8_t* data, size_t size)
+{
+    CacheReader in(data, size);
+
+    if (in.getString() != String8(board) || in.getInt() != cameraId ||
+            in.getString() != String8(fingerprint)) {
+        return false;
+    }
+
+    in.getSizes(&mPreviewSizes);
+    in.getSizes(&mPictureSizes);
+    in.getSizes(&mVideoSizes);
+    in.getSizes(&mThumbnailSizes);
+    mPreviewFpsRanges.clear();
+    for (size_t i = in.getCount(2 * sizeof(int32_t)); i > 0; i--) {
+        FpsRange range;
+        range.min = in.getInt();
+        range.max = in.getInt();
+        mPreviewFpsRanges.push(range);
+    }
+    in.getInts(&mPreviewFrameRates);
+    in.getStrings(&mPreviewFormats);
+    in.getStrings(&mPictureFormats);
+    in.getStrings(&mFocusModes);
+    in.getStrings(&mFlashModes);
+    in.getStrings(&mSceneModes);
+    in.getStrings(&mWhiteBalances);
+    in.getStrings(&mEffects);
+    in.getStrings(&mAntibanding);
+    in.getInts(&mZoomRatios);
+    mMaxZoom = in.getInt();
+    mZoomSupported = in.getInt();
+    mSmoothZoomSupported = in.getInt();
+    mMinExposure = in.getInt();
+    mMaxExposure = in.getInt();
+    mExposureStep = in.getFloat();
+    mMaxFacesHw = in.getInt();
+    mMaxFacesSw = in.getInt();
+    return in.ok();
+}
+
+status_t CameraCapabilities::save(const char* board, int cameraId,
+        const char* fingerprint) const
+{
+    String8 payload;
+    encode(board, cameraId, fingerprint, &payload);
+
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.size = payload.size();
+    header.checksum = checksum(
+            reinterpret_cast<const uint8_t*>(payload.string()), payload.size());
+
+    // Write a temporary file and rename it into place, so that a concurrent
+    // load sees either the old file or the new one, never half of either.
+    String8 path = cachePath(board, cameraId);
+    String8 temp = path;
+    temp.appendFormat(".%d", getpid());
+    int fd = open(temp.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOGW("Cannot create %s: %s", temp.string(), strerror(errno));
+        return -errno;
+    }
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+              write(fd, payload.string(), payload.size()) == (ssize_t)payload.size();
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp.string(), path.string()) != 0) {
+        LOGW("Cannot write %s: %s", path.string(), strerror(errno));
+        unlink(temp.string());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+sp<CameraCapabilities> CameraCapabilities::load(const char* board,
+        int cameraId, const char* fingerprint)
+{
+    String8 path = cachePath(board, cameraId);
+    int fd = open(path.string(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    CacheHeader header;
+    uint8_t* payload = 0;
+    bool ok = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+              header.magic == CACHE_MAGIC &&
+              header.version == CACHE_VERSION &&
+              header.size <= CACHE_MAX_SIZE &&
+              (payload = static_cast<uint8_t*>(malloc(header.size + 1))) != 0 &&
+              read(fd, payload, header.size + 1) == (ssize_t)header.size &&
+              checksum(payload, header.size) == header.checksum;
+    close(fd);
+
+    sp<CameraCapabilities> caps;
+    if (ok) {
+        caps = new CameraCapabilities();
+        ok = caps->decode(board, cameraId, fingerprint, payload, header.size);
+    }
+    free(payload);
+
+    if (!ok) {
+        // Stale or damaged; the caller builds and saves a fresh one.
+        LOGI("Ignoring stale camera capabilities in %s", path.string());
+        unlink(path.string());
+        return 0;
+    }
+
+    if (cameraId >= 0 && cameraId < MAX_CAMERAS) {
+        Mutex::Autolock lock(sCapabilitiesLock);
+        sCapabilities[cameraId] = caps;
+    }
+    return caps;
+}
@@ -0,0 +1,148 @@
+#ifndef __CAMERA_CAPABILITIES_H
+#define __CAMERA_CAPABILITIES_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <camera/CameraParameters.h>
+#include <hardware/hardware.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "CameraParametersFlat.h"
+
+// Where save() and load() keep one file per board and camera id.
+#ifndef CAMERA_CAPABILITIES_CACHE_DIR
+#define CAMERA_CAPABILITIES_CACHE_DIR "/data/local/tmp"
+#endif
+
+namespace android {
+
+// CameraCapabilities holds what a camera supports, parsed once out of the
+// KEY_SUPPORTED_* and related parameters into typed arrays, so that stream
+// setup can pick sizes, rates and modes without re-parsing parameter text.
+//
+// Capabilities do not change while a camera is open, so they are built once
+// per camera id and shared by every later user in the process. They do not
+// change across processes either, until the HAL does, so save() writes them
+// to a small binary file that a later process can load() without opening
+// the camera at all.
+class CameraCapabilities : public LightRefBase<CameraCapabilities>
+{
+public:
+    enum { MAX_CAMERAS = 8 };
+
+    // FpsRange is one entry of KEY_SUPPORTED_PREVIEW_FPS_RANGE, in frames
+    // per second times 1000.
+    struct FpsRange {
+        int min;
+        int max;
+    };
+
+    // lookup returns the capabilities built for cameraId, or NULL.
+    static sp<CameraCapabilities> lookup(int cameraId);
+
+    // build parses the flattened parameters of cameraId and remembers the
+    // result for lookup.
+    static sp<CameraCapabilities> build(int cameraId, const char* flattened);
+
+    // load reads the capabilities saved for board and cameraId, and
+    // remembers them for lookup. It returns NULL if there is no such file,
+    // or if it is damaged or was written for a different fingerprint; the
+    // caller should then build and save them again.
+    static sp<CameraCapabilities> load(const char* board, int cameraId,
+            const char* fingerprint);
+
+    // save writes these capabilities for a later load, replacing any file
+    // already there.
+    status_t save(const char* board, int cameraId,
+            const char* fingerprint) const;
+
+    // fingerprint identifies the camera HAL in use: the build fingerprint,
+    // which changes with any system update, and module's name and version
+    // if given.
+    static String8 fingerprint(const hw_module_t* module);
+
+    // closestSize returns the index of the size in sizes closest in area to
+    // width x height, or -1 if sizes is empty. *delta, if given, receives
+    // the difference in area.
+    static ssize_t closestSize(const Vector<Size>& sizes, int width,
+            int height, uint32_t* delta = 0);
+
+    // contains tells whether value is one of values.
+    static bool contains(const Vector<String8>& values, const char* value);
+
+    const Vector<Size>& previewSizes() const        { return mPreviewSizes; }
+    const Vector<Size>& pictureSizes() const        { return mPictureSizes; }
+    const Vector<Size>& videoSizes() const          { return mVideoSizes; }
+    const Vector<Size>& thumbnailSizes() const      { return mThumbnailSizes; }
+    const Vector<FpsRange>& previewFpsRanges() const { return mPreviewFpsRanges; }
+    const Vector<int>& previewFrameRates() const    { return mPreviewFrameRates; }
+    const Vector<String8>& previewFormats() const   { return mPreviewFormats; }
+    const Vector<String8>& pictureFormats() const   { return mPictureFormats; }
+    const Vector<String8>& focusModes() const       { return mFocusModes; }
+    const Vector<String8>& flashModes() const       { return mFlashModes; }
+    const Vector<String8>& sceneModes() const       { return mSceneModes; }
+    const Vector<String8>& whiteBalances() const    { return mWhiteBalances; }
+    const Vector<String8>& effects() const          { return mEffects; }
+    const Vector<String8>& antibanding() const      { return mAntibanding; }
+
+    // mZoomRatios are in percent, one per zoom step up to maxZoom.
+    const Vector<int>& zoomRatios() const           { return mZoomRatios; }
+    int maxZoom() const                             { return mMaxZoom; }
+    bool zoomSupported() const                      { return mZoomSupported; }
+    bool smoothZoomSupported() const                { return mSmoothZoomSupported; }
+
+    int minExposureCompensation() const             { return mMinExposure; }
+    int maxExposureCompensation() const             { return mMaxExposure; }
+    float exposureCompensationStep() const          { return mExposureStep; }
+    int maxDetectedFacesHw() const                  { return mMaxFacesHw; }
+    int maxDetectedFacesSw() const                  { return mMaxFacesSw; }
+
+private:
+    friend class LightRefBase<CameraCapabilities>;
+
+    CameraCapabilities();
+    ~CameraCapabilities();
+
+    void parse(const FlatCameraParameters& params);
+    void encode(const char* board, int cameraId, const char* fingerprint,
+            String8* out) const;
+    bool decode(const char* board, int cameraId, const char* fingerprint,
+            const uint8_t* data, size_t size);
+    static String8 cachePath(const char* board, int cameraId);
+
+    static void parseSizes(const char* list, Vector<Size>* sizes);
+    static void parseFpsRanges(const char* list, Vector<FpsRange>* ranges);
+    static void parseInts(const char* list, Vector<int>* values);
+    static void parseStrings(const char* list, Vector<String8>* values);
+
+    Vector<Size> mPreviewSizes;
+    Vector<Size> mPictureSizes;
+    Vector<Size> mVideoSizes;
+    Vector<Size> mThumbnailSizes;
+    Vector<FpsRange> mPreviewFpsRanges;
+    Vector<int> mPreviewFrameRates;
+    Vector<String8> mPreviewFormats;
+    Vector<String8> mPictureFormats;
+    Vector<String8> mFocusModes;
+    Vector<String8> mFlashModes;
+    Vector<String8> mSceneModes;
+    Vector<String8> mWhiteBalances;
+    Vector<String8> mEffects;
+    Vector<String8> mAntibanding;
+    Vector<int> mZoomRatios;
+    int mMaxZoom;
+    bool mZoomSupported;
+    bool mSmoothZoomSupported;
+    int mMinExposure;
+    int mMaxExposure;
+    float mExposureStep;
+    int mMaxFacesHw;
+    int mMaxFacesSw;
+};
+
+}; // namespace android
+
+#endif // __CAMERA_CAPABILITIES_H
@@ -0,0 +1,295 @@
+#ifndef __CAMERA_COMMAND_THREAD_H
+#define __CAMERA_COMMAND_THREAD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <camera/CameraParameters.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+namespace android {
+
+// CameraCommandResult is the future handed back for every command posted to
+// a CameraCommandThread. It completes once the HAL call has returned.
+class CameraCommandResult : public RefBase
+{
+public:
+    CameraCommandResult()
+        : mDone(false), mStatus(NO_ERROR), mQueueTime(systemTime()),
+          mValue(0), mStartTime(0), mDoneTime(0) { }
+
+    // wait blocks until the command has run and returns its status.
+    status_t wait() {
+        Mutex::Autolock lock(mMutex);
+        while (!mDone) {
+            mCondition.wait(mMutex);
+        }
+        return mStatus;
+    }
+
+    // waitRelative is wait with a timeout; it returns TIMED_OUT if the
+    // command has not run by then and leaves *status untouched.
+    status_t waitRelative(nsecs_t timeout, status_t* status) {
+        Mutex::Autolock lock(mMutex);
+        nsecs_t deadline = systemTime() + timeout;
+        while (!mDone) {
+            nsecs_t now = systemTime();
+            if (now >= deadline) {
+                return TIMED_OUT;
+            }
+            mCondition.waitRelative(mMutex, deadline - now);
+        }
+        *status = mStatus;
+        return NO_ERROR;
+    }
+
+    // poll returns true and the status if the command has completed.
+    bool poll(status_t* status) const {
+        Mutex::Autolock lock(mMutex);
+        if (mDone && status) {
+            *status = mStatus;
+        }
+        return mDone;
+    }
+
+    // value is what the command found out besides its status, such as
+    // whether ensurePreview() had to start the preview; 0 until it ran.
+    int32_t value() const {
+        Mutex::Autolock lock(mMutex);
+        return mValue;
+    }
+
+    // latency is the time from posting to completion, 0 until then.
+    nsecs_t latency() const {
+        Mutex::Autolock lock(mMutex);
+        return mDone ? mDoneTime - mQueueTime : 0;
+    }
+
+    // startTime is when the command thread made the HAL call, which can be
+    // well after posting if other commands were queued ahead; 0 until then.
+    nsecs_t startTime() const {
+        Mutex::Autolock lock(mMutex);
+        return mStartTime;
+    }
+
+    void start() {
+        Mutex::Autolock lock(mMutex);
+        mStartTime = systemTime();
+    }
+
+    void complete(status_t status, int32_t value = 0) {
+        Mutex::Autolock lock(mMutex);
+        mStatus = status;
+        mValue = value;
+        mDone = true;
+        mDoneTime = systemTime();
+        mCondition.broadcast();
+    }
+
+private:
+    mutable Mutex mMutex;
+    Condition mCondition;
+    bool mDone;
+    status_t mStatus;
+    int32_t mValue;
+    nsecs_t mQueueTime;
+    nsecs_t mStartTime;
+    nsecs_t mDoneTime;
+};
+
+// CameraCommandThread serializes the slow HAL calls of one camera on a thread
+// of its own, so the caller's event loop never blocks in the HAL. Commands
+// run in the order they were posted and callers may post several without
+// waiting; a failed command is also reported to the error callback, on the
+// command thread.
+//
+// CAMERA is any of the CameraHardwareInterface flavours.
+template <class CAMERA>
+class CameraCommandThread : public Thread
+{
+public:
+    typedef void (*error_callback)(const char* command, status_t status,
+            void* user);
+
+    CameraCommandThread(const sp<CAMERA>& camera)
+        : Thread(false), mCamera(camera), mQuit(false), mErrorCb(0),
+          mErrorCbUser(0) { }
+
+    void setErrorCallback(error_callback cb, void* user) {
+        Mutex::Autolock lock(mMutex);
+        mErrorCb = cb;
+        mErrorCbUser = user;
+    }
+
+    sp<CameraCommandResult> startPreview()  { return post(START_PREVIEW); }
+    sp<CameraCommandResult> stopPreview()   { return post(STOP_PREVIEW); }
+    sp<CameraCommandResult> autoFocus()     { return post(AUTO_FOCUS); }
+    sp<CameraCommandResult> cancelAutoFocus() { return post(CANCEL_AUTO_FOCUS); }
+    sp<CameraCommandResult> takePicture()   { return post(TAKE_PICTURE); }
+    sp<CameraCommandResult> release()       { return post(RELEASE); }
+
+    // ensurePreview starts the preview unless the HAL says it is already
+    // running; the result's value is 1 if it had to. Asking here, rather
+    // than calling previewEnabled() from the caller's thread, keeps the
+    // query in order with the commands queued before it.
+    sp<CameraCommandResult> ensurePreview() { return post(ENSURE_PREVIEW); }
+
+    // setParameters replaces a setParameters that is still waiting in the
+    // queue behind other commands, since only the newest set would stick,
+    // and returns the pending command's result.
+    sp<CameraCommandResult> setParameters(const CameraParameters& params) {
+        Mutex::Autolock lock(mMutex);
+        if (!mQueue.isEmpty()) {
+            Command& last = mQueue.editItemAt(mQueue.size() - 1);
+            if (last.mType == SET_PARAMETERS) {
+                last.mParams = params;
+                return last.mResult;
+            }
+        }
+        return postLocked(SET_PARAMETERS, &params);
+    }
+
+    // quit finishes the commands already posted and stops the thread. It
+    // must not be called from the command thread itself.
+    void quit() {
+        {
+            Mutex::Autolock lock(mMutex);
+            mQuit = true;
+            mCondition.signal();
+        }
+        // Not requestExitAndWait(), which would stop the thread after the
+        // command in hand and strand whoever waits on the queued ones:
+        // threadLoop() itself returns false once the queue is empty.
+        join();
+    }
+
+private:
+    enum CommandType {
+        START_PREVIEW,
+        ENSURE_PREVIEW,
+        STOP_PREVIEW,
+        AUTO_FOCUS,
+        CANCEL_AUTO_FOCUS,
+        TAKE_PICTURE,
+        SET_PARAMETERS,
+        RELEASE
+    };
+
+    struct Command {
+        CommandType mType;
+        CameraParameters mParams;
+        sp<CameraCommandResult> mResult;
+    };
+
+    static const char* commandName(CommandType type) {
+        switch (type) {
+            case START_PREVIEW:     return "startPreview";
+            case ENSURE_PREVIEW:    return "startPreview";
+            case STOP_PREVIEW:      return "stopPreview";
+            case AUTO_FOCUS:        return "autoFocus";
+            case CANCEL_AUTO_FOCUS: return "cancelAutoFocus";
+            case TAKE_PICTURE:      return "takePicture";
+            case SET_PARAMETERS:    return "setParameters";
+            case RELEASE:           return "release";
+        }
+        return "unknown";
+    }
+
+    sp<CameraCommandResult> post(CommandType type) {
+        Mutex::Autolock lock(mMutex);
+        return postLocked(type, 0);
+    }
+
+    sp<CameraCommandResult> postLocked(CommandType type,
+            const CameraParameters* params) {
+        Command command;
+        command.mType = type;
+        if (params) {
+            command.mParams = *params;
+        }
+        command.mResult = new CameraCommandResult();
+        if (mQuit) {
+            command.mResult->complete(INVALID_OPERATION);
+            return command.mResult;
+        }
+        mQueue.push(command);
+        mCondition.signal();
+        return command.mResult;
+    }
+
+    status_t execute(const Command& command, int32_t* value) {
+        switch (command.mType) {
+            case START_PREVIEW:
+                return mCamera->startPreview();
+            case ENSURE_PREVIEW:
+                if (mCamera->previewEnabled()) {
+                    return NO_ERROR;
+                }
+                *value = 1;
+                return mCamera->startPreview();
+            case STOP_PREVIEW:
+                mCamera->stopPreview();
+                return NO_ERROR;
+            case AUTO_FOCUS:
+                return mCamera->autoFocus();
+            case CANCEL_AUTO_FOCUS:
+                return mCamera->cancelAutoFocus();
+            case TAKE_PICTURE:
+                return mCamera->takePicture();
+            case SET_PARAMETERS:
+                return mCamera->setParameters(command.mParams);
+            case RELEASE:
+                mCamera->release();
+                return NO_ERROR;
+        }
+        return BAD_VALUE;
+    }
+
+    virtual bool threadLoop() {
+        Command command;
+        error_callback errorCb;
+        void* errorCbUser;
+        {
+            Mutex::Autolock lock(mMutex);
+            while (mQueue.isEmpty() && !mQuit) {
+                mCondition.wait(mMutex);
+            }
+            if (mQueue.isEmpty()) {
+                return false;
+            }
+            command = mQueue[0];
+            mQueue.removeAt(0);
+            errorCb = mErrorCb;
+            errorCbUser = mErrorCbUser;
+        }
+
+        command.mResult->start();
+        int32_t value = 0;
+        status_t status = execute(command, &value);
+        command.mResult->complete(status, value);
+        if (status != NO_ERROR && errorCb) {
+            errorCb(commandName(command.mType), status, errorCbUser);
+        }
+        return true;
+    }
+
+    // mCamera is only touched from the command thread once it is running.
+    sp<CAMERA> mCamera;
+
+    // mMutex guards the fields below; mCondition is signalled whenever a
+    // command is posted or the thread is asked to quit.
+    mutable Mutex mMutex;
+    Condition mCondition;
+    Vector<Command> mQueue;
+    bool mQuit;
+    error_callback mErrorCb;
+    void* mErrorCbUser;
+};
+
+}; // namespace android
+
+#endif // __CAMERA_COMMAND_THREAD_H
@@ -0,0 +1,115 @@
+#ifndef __CAMERA_EVENT_QUEUE_H
+#define __CAMERA_EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <binder/IMemory.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+namespace android {
+
+// CameraEvent is one occurrence reported by a HAL callback or a helper
+// thread. type is the receiver's own event code; ext1 and ext2 carry the
+// notify arguments or a status, and data the buffer, if any.
+struct CameraEvent {
+    CameraEvent() : type(0), ext1(0), ext2(0), timestamp(0) { }
+
+    int32_t type;
+    int32_t ext1;
+    int32_t ext2;
+    sp<IMemory> data;
+    // timestamp is SYSTEM_TIME_MONOTONIC when the event was posted.
+    nsecs_t timestamp;
+};
+
+// CameraEventQueue carries events from any number of posting threads (the
+// HAL's callback threads, a command thread, ...) to the one thread that
+// waits on it. Unlike a single "last event" slot, every event is kept, in
+// the order posted, together with its own payload, so that back-to-back
+// callbacks such as shutter, raw and JPEG are all seen.
+class CameraEventQueue
+{
+public:
+    CameraEventQueue() : mPosted(0), mMaxDepth(0) { }
+
+    // post queues an event of the given type, stamped with the current
+    // time, and wakes the waiting thread.
+    void post(int32_t type, int32_t ext1 = 0, int32_t ext2 = 0,
+            const sp<IMemory>& data = 0) {
+        CameraEvent event;
+        event.type = type;
+        event.ext1 = ext1;
+        event.ext2 = ext2;
+        event.data = data;
+        event.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        Mutex::Autolock lock(mMutex);
+        mQueue.push(event);
+        mPosted++;
+        if (mQueue.size() > mMaxDepth) {
+            mMaxDepth = mQueue.size();
+        }
+        mCondition.signal();
+    }
+
+    // wait removes the oldest event, blocking until there is one.
+    void wait(CameraEvent* event) {
+        Mutex::Autolock lock(mMutex);
+        while (mQueue.isEmpty()) {
+            mCondition.wait(mMutex);
+        }
+        takeLocked(event);
+    }
+
+    // waitRelative is wait with a timeout; it returns TIMED_OUT, leaving
+    // *event untouched, if nothing was posted in time.
+    status_t waitRelative(CameraEvent* event, nsecs_t timeout) {
+        Mutex::Autolock lock(mMutex);
+        nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+        while (mQueue.isEmpty()) {
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (now >= deadline) {
+                return TIMED_OUT;
+            }
+            mCondition.waitRelative(mMutex, deadline - now);
+        }
+        takeLocked(event);
+        return NO_ERROR;
+    }
+
+    size_t size() const {
+        Mutex::Autolock lock(mMutex);
+        return mQueue.size();
+    }
+
+    // posted is the number of events ever posted, and maxDepth the most
+    // that were ever waiting at once.
+    uint32_t posted() const {
+        Mutex::Autolock lock(mMutex);
+        return mPosted;
+    }
+    size_t maxDepth() const {
+        Mutex::Autolock lock(mMutex);
+        return mMaxDepth;
+    }
+
+private:
+    void takeLocked(CameraEvent* event) {
+        *event = mQueue[0];
+        mQueue.removeAt(0);
+    }
+
+    mutable Mutex mMutex;
+    Condition mCondition;
+    Vector<CameraEvent> mQueue;
+    uint32_t mPosted;
+    size_t mMaxDepth;
+};
+
+}; // namespace android
+
+#endif // __CAMERA_EVENT_QUEUE_H
@@ -0,0 +1,80 @@
+#ifndef ANDROID_HARDWARE_CAMERA_FRAME_FACES_H
+#define ANDROID_HARDWARE_CAMERA_FRAME_FACES_H
+
+#include <stdint.h>
+#include <string.h>
+#include <system/camera.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/**
+ * Face-detection results for one preview frame, as side data a client can
+ * keep after the HAL's camera_frame_metadata_t goes away.  It has a fixed
+ * size so it can live on the stack or inside another object and be copied
+ * on every frame without touching the heap.
+ *
+ * Coordinates use the HAL's [-1000, 1000] driver space, which fits in 16
+ * bits; a missing landmark is reported by the HAL as -2000 and kept as is.
+ */
+struct CameraFace {
+	int16_t rect[4];            // left, top, right, bottom
+	int16_t leftEye[2];
+	int16_t rightEye[2];
+	int16_t mouth[2];
+	uint8_t score;              // 1..100
+	int32_t id;
+};
+
+struct CameraFrameFaces {
+	enum { MAX_FACES = 16 };
+
+	nsecs_t timestamp;          // when the metadata arrived
+	int32_t numFaces;           // faces reported by the HAL
+	int32_t numStored;          // faces copied, at most MAX_FACES
+	CameraFace faces[MAX_FACES];
+
+	void clear()
+	{
+		timestamp = 0;
+		numFaces = 0;
+		numStored = 0;
+	}
+
+	/** Copy the faces out of metadata; a NULL metadata means no faces. */
+	void set(const camera_frame_metadata_t *metadata, nsecs_t when)
+	{
+		timestamp = when;
+		numFaces = metadata ? metadata->number_of_faces : 0;
+		if (numFaces < 0)
+			numFaces = 0;
+		numStored = numFaces < MAX_FACES ? numFaces : MAX_FACES;
+
+		for (int32_t i = 0; i < numStored; i++) {
+			const camera_face_t &in = metadata->faces[i];
+			CameraFace &out = faces[i];
+			for (int j = 0; j < 4; j++)
+				out.rect[j] = in.rect[j];
+			for (int j = 0; j < 2; j++) {
+				out.leftEye[j] = in.left_eye[j];
+				out.rightEye[j] = in.right_eye[j];
+				out.mouth[j] = in.mouth[j];
+			}
+			out.score = in.score;
+			out.id = in.id;
+		}
+	}
+
+	/** Copy only the used part of another result. */
+	void copyFrom(const CameraFrameFaces &other)
+	{
+		timestamp = other.timestamp;
+		numFaces = other.numFaces;
+		numStored = other.numStored;
+		memcpy(faces, other.faces, numStored * sizeof(faces[0]));
+	}
+};
+
+};  // namespace android
+
+#endif
@@ -20,7 +20,10 @@
 #include <binder/IMemory.h>
 #include <binder/MemoryBase.h>
 #include <binder/MemoryHeapBase.h>
+#include <cutils/atomic.h>
 #include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
 #include <surfaceflinger/ISurface.h>
 #include <ui/android_native_buffer.h>
 #include <ui/GraphicBuffer.h>
@@ -29,6 +32,9 @@
 #include <system/window.h>
 #include <hardware/camera.h>
 
+#include "CameraPreviewWindow.h"
+#include "CameraTrace.h"
+
 #ifndef ALOGE
 #define ALOGE(...)   ((void)0)
 #endif
@@ -97,6 +103,14 @@ public:
 	{
 		mDevice = 0;
 		mName = name;
+		mParametersGeneration = 1;
+		mCachedParametersGeneration = 0;
+		mCachedStringGeneration = 0;
+		mMemoryPoolLimit = DEFAULT_MEMORY_POOL_LIMIT;
+		mMemoryPoolBytes = 0;
+		mMemoryPoolHits = 0;
+		mMemoryPoolMisses = 0;
+		mDataCbMetadata = 0;
 	}
 
 	~CameraHardwareInterface()
@@ -125,13 +139,11 @@ public:
 	/** Set the ANativeWindow to which preview frames are sent */
 	status_t setPreviewWindow(const sp<ANativeWindow>& buf)
 	{
-		ALOGE("%s(%s) buf %p", __FUNCTION__, mName.string(), buf.get());
+		CAMERA_TRACE_CALL(mName.string(), buf.get() != 0, 0);
 
 		if (mDevice->ops->set_preview_window) {
 			mPreviewWindow = buf;
-			mHalPreviewWindow.user = this;
-			ALOGE("%s &mHalPreviewWindow %p mHalPreviewWindow.user %p", __FUNCTION__,
-					&mHalPreviewWindow, mHalPreviewWindow.user);
+			mHalPreviewWindow.window = buf.get();
 			return mDevice->ops->set_preview_window(mDevice,
 					buf.get() ? &mHalPreviewWindow.nw : 0);
 		}
@@ -149,7 +161,7 @@ public:
 		mDataCbTimestamp = data_cb_timestamp;
 		mCbUser = user;
 
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 
 		if (mDevice->ops->set_callbacks) {
 			mDevice->ops->set_callbacks(mDevice,
@@ -161,6 +173,18 @@ public:
 		}
 	}
 
+	/**
+	 * Install a data callback that also receives the frame metadata, e.g.
+	 * face-detection results for CAMERA_MSG_PREVIEW_METADATA.  Once set it
+	 * replaces the setCallbacks() data callback for every message; pass 0
+	 * to go back to it.  The metadata is only valid during the callback.
+	 */
+	void setMetadataCallback(data_callback_ics data_cb)
+	{
+		CAMERA_TRACE_CALL(mName.string(), data_cb != 0, 0);
+		mDataCbMetadata = data_cb;
+	}
+
 	/**
 	 * The following three functions all take a msgtype,
 	 * which is a bitmask of the messages defined in
@@ -172,7 +196,7 @@ public:
 	 */
 	void enableMsgType(int32_t msgType)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), msgType, 0);
 		if (mDevice->ops->enable_msg_type)
 			mDevice->ops->enable_msg_type(mDevice, msgType);
 	}
@@ -189,7 +213,7 @@ public:
 	 */
 	void disableMsgType(int32_t msgType)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), msgType, 0);
 		if (mDevice->ops->disable_msg_type)
 			mDevice->ops->disable_msg_type(mDevice, msgType);
 	}
@@ -201,7 +225,7 @@ public:
 	 */
 	int msgTypeEnabled(int32_t msgType)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), msgType, 0);
 		if (mDevice->ops->msg_type_enabled)
 			return mDevice->ops->msg_type_enabled(mDevice, msgType);
 		return false;
@@ -212,10 +236,14 @@ public:
 	 */
 	status_t startPreview()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
+		// focus distances may change when preview starts
+		invalidateParameters();
+		status_t res = INVALID_OPERATION;
 		if (mDevice->ops->start_preview)
-			return mDevice->ops->start_preview(mDevice);
-		return INVALID_OPERATION;
+			res = mDevice->ops->start_preview(mDevice);
+		invalidateParameters();
+		return res;
 	}
 
 	/**
@@ -223,12 +251,10 @@ public:
 	 */
 	void stopPreview()
 	{
-		printf_stderr("XxXxX HW stopPreview()");
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->stop_preview) {
-			printf_stderr("XxXxX HW before ops->stop_preview");
 			mDevice->ops->stop_preview(mDevice);
-			printf_stderr("XxXxX HW after ops->stop_preview");
+			CAMERA_TRACE_CALL(mName.string(), 1, 0);
 		}
 	}
 
@@ -237,7 +263,7 @@ public:
 	 */
 	int previewEnabled()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->preview_enabled)
 			return mDevice->ops->preview_enabled(mDevice);
 		return false;
@@ -277,7 +303,7 @@ public:
 
 	status_t storeMetaDataInBuffers(int enable)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), enable, 0);
 		if (mDevice->ops->store_meta_data_in_buffers)
 			return mDevice->ops->store_meta_data_in_buffers(mDevice, enable);
 		return enable ? INVALID_OPERATION: OK;
@@ -294,7 +320,7 @@ public:
 	 */
 	status_t startRecording()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->start_recording)
 			return mDevice->ops->start_recording(mDevice);
 		return INVALID_OPERATION;
@@ -305,7 +331,7 @@ public:
 	 */
 	void stopRecording()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->stop_recording)
 			mDevice->ops->stop_recording(mDevice);
 	}
@@ -315,7 +341,7 @@ public:
 	 */
 	int recordingEnabled()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->recording_enabled)
 			return mDevice->ops->recording_enabled(mDevice);
 		return false;
@@ -333,7 +359,7 @@ public:
 	 */
 	void releaseRecordingFrame(const sp<IMemory>& mem)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->release_recording_frame) {
 			ssize_t offset;
 			size_t size;
@@ -350,10 +376,13 @@ public:
 	 */
 	status_t autoFocus()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
+		invalidateParameters();
+		status_t res = INVALID_OPERATION;
 		if (mDevice->ops->auto_focus)
-			return mDevice->ops->auto_focus(mDevice);
-		return INVALID_OPERATION;
+			res = mDevice->ops->auto_focus(mDevice);
+		invalidateParameters();
+		return res;
 	}
 
 	/**
@@ -364,10 +393,13 @@ public:
 	 */
 	status_t cancelAutoFocus()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
+		invalidateParameters();
+		status_t res = INVALID_OPERATION;
 		if (mDevice->ops->cancel_auto_focus)
-			return mDevice->ops->cancel_auto_focus(mDevice);
-		return INVALID_OPERATION;
+			res = mDevice->ops->cancel_auto_focus(mDevice);
+		invalidateParameters();
+		return res;
 	}
 
 	/**
@@ -375,7 +407,7 @@ public:
 	 */
 	status_t takePicture()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->take_picture)
 			return mDevice->ops->take_picture(mDevice);
 		return INVALID_OPERATION;
@@ -387,7 +419,7 @@ public:
 	 */
 	status_t cancelPicture()
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->cancel_picture)
 			return mDevice->ops->cancel_picture(mDevice);
 		return INVALID_OPERATION;
@@ -398,28 +430,60 @@ public:
 	 * invalid or not supported. */
 	status_t setParameters(const CameraParameters &params)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
+		// the HAL may reject or adjust any value, even on failure
+		invalidateParameters();
+		status_t res = INVALID_OPERATION;
 		if (mDevice->ops->set_parameters)
-			return mDevice->ops->set_parameters(mDevice,
-											   params.flatten().string());
-		return INVALID_OPERATION;
+			res = mDevice->ops->set_parameters(mDevice,
+											  params.flatten().string());
+		invalidateParameters();
+		return res;
 	}
 
-	/** Return the camera parameters. */
+	/**
+	 * Return the camera parameters.  The parsed parameters are cached until
+	 * something that may change them (setParameters(), sendCommand(),
+	 * focus/zoom notifications, ...) invalidates the cache, so repeated
+	 * calls do not go back to the HAL.  CameraParameters shares its storage
+	 * on copy, so returning the cached copy is cheap.
+	 */
 	CameraParameters getParameters() const
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
-		CameraParameters parms;
-		if (mDevice->ops->get_parameters) {
-			char *temp = mDevice->ops->get_parameters(mDevice);
-			String8 str_parms(temp);
-			if (mDevice->ops->put_parameters)
-				mDevice->ops->put_parameters(mDevice, temp);
-			else
-				free(temp);
-			parms.unflatten(str_parms);
+		Mutex::Autolock lock(mParametersLock);
+		CAMERA_TRACE_CALL(mName.string(),
+						  mParametersGeneration == mCachedParametersGeneration, 0);
+		const String8 &str_parms = fetchParametersLocked();
+		if (mCachedParametersGeneration != mCachedStringGeneration) {
+			mParameters.unflatten(str_parms);
+			mCachedParametersGeneration = mCachedStringGeneration;
 		}
-		return parms;
+		return mParameters;
+	}
+
+	/**
+	 * Return the camera parameters as the HAL flattened them, for callers
+	 * that parse them themselves (see FlatCameraParameters).  Cached along
+	 * with getParameters(), but not unflattened.
+	 */
+	String8 getParametersString() const
+	{
+		Mutex::Autolock lock(mParametersLock);
+		CAMERA_TRACE_CALL(mName.string(),
+						  mParametersGeneration == mCachedStringGeneration, 0);
+		return fetchParametersLocked();
+	}
+
+	/**
+	 * Drop the cached parameters so the next getParameters() asks the HAL.
+	 * Lock-free, so it may be called from HAL callback threads.  Calls that
+	 * change parameters invalidate again once the HAL returns: a fetch on
+	 * another thread during the call would otherwise be cached under the
+	 * new generation with the old values.
+	 */
+	void invalidateParameters() const
+	{
+		android_atomic_inc(&mParametersGeneration);
 	}
 
 	/**
@@ -427,10 +491,13 @@ public:
 	 */
 	status_t sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), cmd, arg1);
+		invalidateParameters();
+		status_t res = INVALID_OPERATION;
 		if (mDevice->ops->send_command)
-			return mDevice->ops->send_command(mDevice, cmd, arg1, arg2);
-		return INVALID_OPERATION;
+			res = mDevice->ops->send_command(mDevice, cmd, arg1, arg2);
+		invalidateParameters();
+		return res;
 	}
 
 	/**
@@ -438,9 +505,52 @@ public:
 	 * *not* done in the destructor.
 	 */
 	void release() {
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->release)
 			mDevice->ops->release(mDevice);
+		trimMemoryPool();
+	}
+
+	/**
+	 * Anonymous heaps requested by the HAL are kept in a pool after the HAL
+	 * releases them and handed back out for the next request of the same
+	 * buffer size and count.  The pool never holds more than the limit set
+	 * here; 0 disables pooling.
+	 */
+	void setMemoryPoolLimit(size_t bytes)
+	{
+		{
+			Mutex::Autolock lock(mMemoryPoolLock);
+			mMemoryPoolLimit = bytes;
+		}
+		trimMemoryPool(bytes);
+	}
+
+	/**
+	 * Drop idle pooled heaps until the pool holds at most maxBytes, e.g. on
+	 * memory pressure.  Heaps still in use by the HAL or a client are kept.
+	 * Returns the number of bytes released.
+	 */
+	size_t trimMemoryPool(size_t maxBytes = 0)
+	{
+		Mutex::Autolock lock(mMemoryPoolLock);
+		return trimMemoryPoolLocked(maxBytes);
+	}
+
+	struct MemoryPoolStats {
+		size_t bytes;       // currently held by the pool, idle or not
+		size_t entries;
+		uint32_t hits;
+		uint32_t misses;
+	};
+
+	void getMemoryPoolStats(MemoryPoolStats *stats) const
+	{
+		Mutex::Autolock lock(mMemoryPoolLock);
+		stats->bytes = mMemoryPoolBytes;
+		stats->entries = mMemoryPool.size();
+		stats->hits = mMemoryPoolHits;
+		stats->misses = mMemoryPoolMisses;
 	}
 
 	/**
@@ -448,7 +558,7 @@ public:
 	 */
 	status_t dump(int fd, const Vector<String16>& args) const
 	{
-		ALOGE("%s(%s)", __FUNCTION__, mName.string());
+		CAMERA_TRACE_CALL(mName.string(), 0, 0);
 		if (mDevice->ops->dump)
 			return mDevice->ops->dump(mDevice, fd);
 		return OK; // It's fine if the HAL doesn't implement dump()
@@ -458,12 +568,45 @@ private:
 	camera_device_t *mDevice;
 	String8 mName;
 
+	// mParametersGeneration is bumped by every invalidation.
+	// mParametersString is the HAL's flattened string as of
+	// mCachedStringGeneration, and mParameters is parsed from it lazily as
+	// of mCachedParametersGeneration; each is valid while its generation
+	// equals mParametersGeneration.
+	mutable Mutex mParametersLock;
+	mutable CameraParameters mParameters;
+	mutable String8 mParametersString;
+	mutable volatile int32_t mParametersGeneration;
+	mutable int32_t mCachedParametersGeneration;
+	mutable int32_t mCachedStringGeneration;
+
+	const String8 &fetchParametersLocked() const
+	{
+		int32_t generation = mParametersGeneration;
+		if (generation != mCachedStringGeneration &&
+				mDevice->ops->get_parameters) {
+			char *temp = mDevice->ops->get_parameters(mDevice);
+			mParametersString.setTo(temp);
+			if (mDevice->ops->put_parameters)
+				mDevice->ops->put_parameters(mDevice, temp);
+			else
+				free(temp);
+			// an invalidation that raced with the fetch leaves the
+			// generations different, so the next call refetches
+			mCachedStringGeneration = generation;
+		}
+		return mParametersString;
+	}
+
 	static void __notify_cb(int32_t msg_type, int32_t ext1,
 							int32_t ext2, void *user)
 	{
-		ALOGE("%s", __FUNCTION__);
 		CameraHardwareInterface *__this =
 				static_cast<CameraHardwareInterface *>(user);
+		CAMERA_TRACE_CALL(__this->mName.string(), msg_type, ext1);
+		// focus distances and the zoom level are reported via parameters
+		if (msg_type & (CAMERA_MSG_FOCUS | CAMERA_MSG_ZOOM))
+			__this->invalidateParameters();
 		__this->mNotifyCb(msg_type, ext1, ext2, __this->mCbUser);
 	}
 
@@ -472,27 +615,29 @@ private:
 						  camera_frame_metadata_t *metadata,
 						  void *user)
 	{
-		ALOGE("%s", __FUNCTION__);
 		CameraHardwareInterface *__this =
 				static_cast<CameraHardwareInterface *>(user);
+		CAMERA_TRACE_FRAME(__this->mName.string(), msg_type, index);
 		sp<CameraHeapMemory> mem(static_cast<CameraHeapMemory *>(data->handle));
 		if (index >= mem->mNumBufs) {
 			ALOGE("%s: invalid buffer index %d, max allowed is %d", __FUNCTION__,
 				 index, mem->mNumBufs);
 			return;
 		}
-		// XXX used to be
-		// __this->mDataCb(msg_type, mem->mBuffers[index], metadata, __this->mCbUser);
-		__this->mDataCb(msg_type, mem->mBuffers[index], __this->mCbUser);
+		data_callback_ics cb = __this->mDataCbMetadata;
+		if (cb)
+			cb(msg_type, mem->mBuffers[index], metadata, __this->mCbUser);
+		else
+			__this->mDataCb(msg_type, mem->mBuffers[index], __this->mCbUser);
 	}
 
 	static void __data_cb_timestamp(nsecs_t timestamp, int32_t msg_type,
 							 const camera_memory_t *data, unsigned index,
 							 void *user)
 	{
-		ALOGE("%s", __FUNCTION__);
 		CameraHardwareInterface *__this =
 				static_cast<CameraHardwareInterface *>(user);
+		CAMERA_TRACE_FRAME(__this->mName.string(), msg_type, index);
 		// Start refcounting the heap object from here on.  When the clients
 		// drop all references, it will be destroyed (as well as the enclosed
 		// MemoryHeapBase.
@@ -557,9 +702,15 @@ private:
 	};
 
 	static camera_memory_t* __get_memory(int fd, size_t buf_size, uint_t num_bufs,
-										 void *user __attribute__((unused)))
+										 void *user)
 	{
 		CameraHeapMemory *mem;
+		// Only anonymous heaps are pooled; an fd-backed heap is the HAL's
+		// memory.  Some HALs pass no cookie, in which case there is no pool.
+		// A pooled entry comes back with the HAL's reference already taken.
+		if (fd < 0 && user)
+			return &static_cast<CameraHardwareInterface *>(user)->
+					getPooledMemory(buf_size, num_bufs)->handle;
 		if (fd < 0)
 			mem = new CameraHeapMemory(buf_size, num_bufs);
 		else
@@ -577,131 +728,93 @@ private:
 		mem->decStrong(mem);
 	}
 
-	static ANativeWindow *__to_anw(void *user)
+	// An entry is idle when the pool holds the only reference to it, to
+	// each of its MemoryBases and to the heap behind them; anything else
+	// means the HAL or a client may still be reading from it.
+	static bool isIdle(const sp<CameraHeapMemory> &mem)
 	{
-		CameraHardwareInterface *__this =
-				reinterpret_cast<CameraHardwareInterface *>(user);
-		return __this->mPreviewWindow.get();
-	}
-#define anw(n) __to_anw(((struct camera_preview_window *)n)->user)
-
-	static int __dequeue_buffer(struct preview_stream_ops* w,
-								buffer_handle_t** buffer, int *stride)
-	{
-		int rc;
-		ANativeWindow *a = anw(w);
-		ANativeWindowBuffer* anb;
-		rc = a->dequeueBuffer(a, &anb);
-		if (!rc) {
-			*buffer = &anb->handle;
-			*stride = anb->stride;
+		if (mem->getStrongCount() != 1)
+			return false;
+		for (uint_t i = 0; i < mem->mNumBufs; i++) {
+			if (mem->mBuffers[i]->getStrongCount() != 1)
+				return false;
 		}
-		return rc;
+		return mem->mHeap->getStrongCount() == (int32_t)mem->mNumBufs + 1;
 	}
 
-#ifndef container_of
-#define container_of(ptr, type, member) ({                      \
-		const typeof(((type *) 0)->member) *__mptr = (ptr);     \
-		(type *) ((char *) __mptr - (char *)(&((type *)0)->member)); })
-#endif
-
-	static int __lock_buffer(struct preview_stream_ops* w,
-					  buffer_handle_t* buffer)
+	// The HAL's strong reference is taken here, under the lock, so that no
+	// other request can see the entry as idle and hand it out again, and
+	// no trim can free it, before __get_memory returns it.
+	CameraHeapMemory *getPooledMemory(size_t buf_size, uint_t num_bufs)
 	{
-		ANativeWindow *a = anw(w);
-		return a->lockBuffer(a,
-				  container_of(buffer, ANativeWindowBuffer, handle));
-	}
-
-	static int __enqueue_buffer(struct preview_stream_ops* w,
-					  buffer_handle_t* buffer)
-	{
-		ANativeWindow *a = anw(w);
-		return a->queueBuffer(a,
-				  container_of(buffer, ANativeWindowBuffer, handle));
-	}
-
-	static int __cancel_buffer(struct preview_stream_ops* w,
-					  buffer_handle_t* buffer)
-	{
-		ANativeWindow *a = anw(w);
-		return a->cancelBuffer(a,
-				  container_of(buffer, ANativeWindowBuffer, handle));
-	}
+		Mutex::Autolock lock(mMemoryPoolLock);
 
-	static int __set_buffer_count(struct preview_stream_ops* w, int count)
-	{
-		ANativeWindow *a = anw(w);
-		return native_window_set_buffer_count(a, count);
-	}
-
-	static int __set_buffers_geometry(struct preview_stream_ops* w,
-					  int width, int height, int format)
-	{
-		ANativeWindow *a = anw(w);
-		return native_window_set_buffers_geometry(a,
-						  width, height, format);
-	}
-
-	static int __set_crop(struct preview_stream_ops *w,
-					  int left, int top, int right, int bottom)
-	{
-		ANativeWindow *a = anw(w);
-		android_native_rect_t crop;
-		crop.left = left;
-		crop.top = top;
-		crop.right = right;
-		crop.bottom = bottom;
-		return native_window_set_crop(a, &crop);
-	}
-
-	static int __set_usage(struct preview_stream_ops* w, int usage)
-	{
-		ANativeWindow *a = anw(w);
-		return native_window_set_usage(a, usage);
-	}
+		for (size_t i = 0; i < mMemoryPool.size(); i++) {
+			const sp<CameraHeapMemory> &mem = mMemoryPool[i];
+			if (mem->mBufSize == buf_size && mem->mNumBufs == num_bufs &&
+				isIdle(mem)) {
+				mMemoryPoolHits++;
+				mem->incStrong(mem.get());
+				return mem.get();
+			}
+		}
 
-	static int __set_swap_interval(struct preview_stream_ops *w, int interval)
-	{
-		ANativeWindow *a = anw(w);
-		return a->setSwapInterval(a, interval);
+		mMemoryPoolMisses++;
+		CameraHeapMemory *mem = new CameraHeapMemory(buf_size, num_bufs);
+		mem->incStrong(mem);
+		size_t bytes = buf_size * num_bufs;
+		if (bytes <= mMemoryPoolLimit) {
+			if (mMemoryPoolBytes + bytes > mMemoryPoolLimit)
+				trimMemoryPoolLocked(mMemoryPoolLimit - bytes);
+			if (mMemoryPoolBytes + bytes <= mMemoryPoolLimit) {
+				mMemoryPool.push(mem);
+				mMemoryPoolBytes += bytes;
+			}
+		}
+		return mem;
+	}
+
+	// Oldest entries go first.
+	size_t trimMemoryPoolLocked(size_t maxBytes)
+	{
+		size_t freed = 0;
+		for (size_t i = 0; i < mMemoryPool.size() && mMemoryPoolBytes > maxBytes; ) {
+			const sp<CameraHeapMemory> &mem = mMemoryPool[i];
+			if (!isIdle(mem)) {
+				i++;
+				continue;
+			}
+			size_t bytes = mem->mBufSize * mem->mNumBufs;
+			mMemoryPoolBytes -= bytes;
+			freed += bytes;
+			mMemoryPool.removeAt(i);
+		}
+		return freed;
 	}
 
-	static int __get_min_undequeued_buffer_count(
-					  const struct preview_stream_ops *w,
-					  int *count)
+	void initHalPreviewWindow()
 	{
-		ANativeWindow *a = anw(w);
-		return a->query(a, NATIVE_WINDOW_MIN_UNDEQUEUED_BUFFERS, count);
+		CameraPreviewWindow::init(&mHalPreviewWindow);
 	}
 
-	void initHalPreviewWindow()
-	{
-		mHalPreviewWindow.nw.cancel_buffer = __cancel_buffer;
-		mHalPreviewWindow.nw.lock_buffer = __lock_buffer;
-		mHalPreviewWindow.nw.dequeue_buffer = __dequeue_buffer;
-		mHalPreviewWindow.nw.enqueue_buffer = __enqueue_buffer;
-		mHalPreviewWindow.nw.set_buffer_count = __set_buffer_count;
-		mHalPreviewWindow.nw.set_buffers_geometry = __set_buffers_geometry;
-		mHalPreviewWindow.nw.set_crop = __set_crop;
-		mHalPreviewWindow.nw.set_usage = __set_usage;
-		mHalPreviewWindow.nw.set_swap_interval = __set_swap_interval;
+	enum { DEFAULT_MEMORY_POOL_LIMIT = 16 * 1024 * 1024 };
 
-		mHalPreviewWindow.nw.get_min_undequeued_buffer_count =
-				__get_min_undequeued_buffer_count;
-	}
+	// Anonymous heaps handed to the HAL by __get_memory, reused once idle.
+	// The pool's own reference keeps them alive between requests.
+	mutable Mutex mMemoryPoolLock;
+	Vector< sp<CameraHeapMemory> > mMemoryPool;
+	size_t mMemoryPoolLimit;
+	size_t mMemoryPoolBytes;
+	uint32_t mMemoryPoolHits;
+	uint32_t mMemoryPoolMisses;
 
 	sp<ANativeWindow>        mPreviewWindow;
 
-	struct camera_preview_window {
-		struct preview_stream_ops nw;
-		void *user;
-	};
-
 	struct camera_preview_window mHalPreviewWindow;
 
 	notify_callback         mNotifyCb;
 	data_callback           mDataCb;
+	data_callback_ics       mDataCbMetadata;
 	data_callback_timestamp mDataCbTimestamp;
 	void *mCbUser;
 };
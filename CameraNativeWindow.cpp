@@ -1,6 +1,7 @@
 #include "CameraNativeWindow.h"
 // #include "nsDebug.h"
 #include <stdio.h>
+#include <cutils/atomic.h>
 
 // enable debug logging by setting to 1
 #define CNW_DEBUG 0
@@ -41,9 +42,18 @@ void CameraNativeWindow::init()
     mDefaultHeight = 0;
     mPixelFormat = 0;
     mUsage = 0;
+    mNextCrop.makeInvalid();
+    mNextTransform = 0;
+    mNextScalingMode = NATIVE_WINDOW_SCALING_MODE_FREEZE;
     mTimestamp = NATIVE_WINDOW_TIMESTAMP_AUTO;
     mBufferCount = MIN_BUFFER_SLOTS;
     mFrameCounter = 0;
+    mConsumerEnabled = false;
+    mSynchronousMode = true;
+    mDequeueTimeout = 0;
+    mDequeueTimeoutCount = 0;
+    mRecycledCount = 0;
+    mLastQueueTime = 0;
 }
 
 
@@ -99,6 +109,10 @@ int CameraNativeWindow::hook_perform(ANativeWindow* window, int operation, ...)
 void CameraNativeWindow::freeBufferLocked(int i)
 {
     if (mSlots[i].mGraphicBuffer != NULL) {
+        if (mSlots[i].mLocked) {
+            mSlots[i].mGraphicBuffer->unlock();
+            mSlots[i].mLocked = false;
+        }
         mSlots[i].mGraphicBuffer.clear();
         mSlots[i].mGraphicBuffer = NULL;
     }
@@ -138,6 +152,10 @@ int CameraNativeWindow::setBufferCount(int bufferCount) {
             CNW_LOGE("setBufferCount: client owns some buffers");
             return -EINVAL;
         }
+        if (mSlots[i].mBufferState == BufferSlot::ACQUIRED) {
+            CNW_LOGE("setBufferCount: consumer owns some buffers");
+            return -EINVAL;
+        }
     }
 
     if (bufferCount > mBufferCount) {
@@ -161,28 +179,39 @@ int CameraNativeWindow::dequeueBuffer(android_native_buffer_t** buffer)
     Mutex::Autolock lock(mMutex);
 
     int found = -1;
+    int oldestQueued = -1;
     int dequeuedCount = 0;
     bool tryAgain = true;
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    const nsecs_t deadline = mDequeueTimeout > 0 ? start + mDequeueTimeout : 0;
+    bool waited = false;
 
     CNW_LOGD("dequeueBuffer: E");
     while (tryAgain) {
 
         // look for a free buffer to give to the client
         found = INVALID_BUFFER_SLOT;
+        oldestQueued = INVALID_BUFFER_SLOT;
         dequeuedCount = 0;
         for (int i = 0; i < mBufferCount; i++) {
             const int state = mSlots[i].mBufferState;
             if (state == BufferSlot::DEQUEUED) {
                 dequeuedCount++;
             }
+            else if (state == BufferSlot::QUEUED) {
+                if (oldestQueued < 0 ||
+                        mSlots[i].mFrameNumber < mSlots[oldestQueued].mFrameNumber) {
+                    oldestQueued = i;
+                }
+            }
             else if (state == BufferSlot::FREE) {
                 /* We return the oldest of the free buffers to avoid
                  * stalling the producer if possible.  This is because
                  * the consumer may still have pending reads of the
                  * buffers in flight.
                  */
-                bool isOlder = mSlots[i].mFrameNumber < mSlots[found].mFrameNumber;
-                if (found < 0 || isOlder) {
+                if (found < 0 ||
+                        mSlots[i].mFrameNumber < mSlots[found].mFrameNumber) {
                     found = i;
                 }
             }
@@ -207,11 +236,34 @@ int CameraNativeWindow::dequeueBuffer(android_native_buffer_t** buffer)
         }
 #endif
 
+        // in asynchronous mode the consumer may drop frames, so steal the
+        // oldest one it hasn't acquired yet rather than waiting for it.
+        if (found == INVALID_BUFFER_SLOT && !mSynchronousMode &&
+                oldestQueued != INVALID_BUFFER_SLOT) {
+            CNW_LOGD("dequeueBuffer: recycling queued slot=%d", oldestQueued);
+            found = oldestQueued;
+            mRecycledCount++;
+        }
+
         // we're in synchronous mode and didn't find a buffer, we need to
         // wait for some buffers to be consumed
         tryAgain = (found == INVALID_BUFFER_SLOT);
         if (tryAgain) {
-            mDequeueCondition.wait(mMutex);
+            waited = true;
+            if (deadline == 0) {
+                mDequeueCondition.wait(mMutex);
+                continue;
+            }
+            const nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+            if (remaining <= 0 ||
+                    mDequeueCondition.waitRelative(mMutex, remaining) == TIMED_OUT) {
+                mDequeueTimeoutCount++;
+                mDequeueWaitTime.record(systemTime(SYSTEM_TIME_MONOTONIC) - start);
+                CNW_LOGE("dequeueBuffer: timed out waiting for a buffer "
+                        "(dequeued=%d, timeouts=%u)",
+                        dequeuedCount, mDequeueTimeoutCount);
+                return -EBUSY;
+            }
         }
     }
 
@@ -222,20 +274,30 @@ int CameraNativeWindow::dequeueBuffer(android_native_buffer_t** buffer)
     }
 
     const int buf = found;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (waited) {
+        mDequeueWaitTime.record(now - start);
+    }
 
     // buffer is now in DEQUEUED
     mSlots[buf].mBufferState = BufferSlot::DEQUEUED;
+    mSlots[buf].mDequeueTime = now;
 
     const sp<GraphicBuffer>& gbuf(mSlots[buf].mGraphicBuffer);
 
     if (gbuf == NULL) {
         status_t error;
-        sp<GraphicBuffer> graphicBuffer( new GraphicBuffer( mDefaultWidth, mDefaultHeight, mPixelFormat, mUsage));
+        uint32_t usage = mUsage;
+        if (mConsumerEnabled) {
+            usage |= GraphicBuffer::USAGE_SW_READ_OFTEN;
+        }
+        sp<GraphicBuffer> graphicBuffer( new GraphicBuffer( mDefaultWidth, mDefaultHeight, mPixelFormat, usage));
         error = graphicBuffer->initCheck();
         if (error != NO_ERROR) {
             CNW_LOGE("dequeueBuffer: createGraphicBuffer failed with error %d",error);
             return error;
         }
+        mAllocTime.record(systemTime(SYSTEM_TIME_MONOTONIC) - now);
         mSlots[buf].mGraphicBuffer = graphicBuffer;
     }
     *buffer = mSlots[buf].mGraphicBuffer.get();
@@ -280,19 +342,31 @@ int CameraNativeWindow::queueBuffer(ANativeWindowBuffer* buffer)
         return -EINVAL;
     }
 
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    mHoldTime[buf].record(now - mSlots[buf].mDequeueTime);
+    if (mLastQueueTime != 0) {
+        mQueueInterval.record(now - mLastQueueTime);
+    }
+    mLastQueueTime = now;
+
     int64_t timestamp;
     if (mTimestamp == NATIVE_WINDOW_TIMESTAMP_AUTO) {
-        timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        timestamp = now;
     } else {
         timestamp = mTimestamp;
     }
 
-    //XXX:
-    //mSlots[buf].mBufferState = BufferSlot::QUEUED;
-    //Set the state to FREE as there are no operations on the queued buffer
-    //And, so that the buffer can be dequeued when needed.
-    mSlots[buf].mBufferState = BufferSlot::FREE;
+    // Without a consumer nothing will ever acquire the buffer, so hand it
+    // straight back to the producer.
+    if (mConsumerEnabled) {
+        mSlots[buf].mBufferState = BufferSlot::QUEUED;
+    } else {
+        mSlots[buf].mBufferState = BufferSlot::FREE;
+    }
     mSlots[buf].mTimestamp = timestamp;
+    mSlots[buf].mCrop = mNextCrop;
+    mSlots[buf].mTransform = mNextTransform;
+    mSlots[buf].mScalingMode = mNextScalingMode;
     mFrameCounter++;
     mSlots[buf].mFrameNumber = mFrameCounter;
 
@@ -331,6 +405,134 @@ int CameraNativeWindow::cancelBuffer(ANativeWindowBuffer* buffer)
     return OK;
 }
 
+status_t CameraNativeWindow::setConsumerEnabled(bool enabled)
+{
+    CNW_LOGD("setConsumerEnabled: %d", enabled);
+    Mutex::Autolock lock(mMutex);
+
+    if (enabled == mConsumerEnabled) {
+        return OK;
+    }
+    mConsumerEnabled = enabled;
+
+    if (!enabled) {
+        // Nobody will acquire or release these any more.
+        for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+            const int state = mSlots[i].mBufferState;
+            if (state == BufferSlot::QUEUED || state == BufferSlot::ACQUIRED) {
+                if (mSlots[i].mLocked) {
+                    mSlots[i].mGraphicBuffer->unlock();
+                    mSlots[i].mLocked = false;
+                }
+                mSlots[i].mBufferState = BufferSlot::FREE;
+            }
+        }
+        mDequeueCondition.signal();
+    }
+    return OK;
+}
+
+status_t CameraNativeWindow::acquireBuffer(BufferItem* item)
+{
+    Mutex::Autolock lock(mMutex);
+
+    if (!mConsumerEnabled) {
+        CNW_LOGE("acquireBuffer: consumer is not enabled");
+        return INVALID_OPERATION;
+    }
+
+    int found = INVALID_BUFFER_SLOT;
+    for (int i = 0; i < mBufferCount; i++) {
+        if (mSlots[i].mBufferState == BufferSlot::QUEUED) {
+            if (found < 0 ||
+                    mSlots[i].mFrameNumber > mSlots[found].mFrameNumber) {
+                found = i;
+            }
+        }
+    }
+
+    if (found == INVALID_BUFFER_SLOT) {
+        return WOULD_BLOCK;
+    }
+
+    // Drop the stale frames queued before the one we hand out.
+    bool freed = false;
+    for (int i = 0; i < mBufferCount; i++) {
+        if (i != found && mSlots[i].mBufferState == BufferSlot::QUEUED) {
+            mSlots[i].mBufferState = BufferSlot::FREE;
+            freed = true;
+        }
+    }
+    if (freed) {
+        mDequeueCondition.signal();
+    }
+
+    mSlots[found].mBufferState = BufferSlot::ACQUIRED;
+    item->mGraphicBuffer = mSlots[found].mGraphicBuffer;
+    item->mSlot = found;
+    item->mTimestamp = mSlots[found].mTimestamp;
+    item->mFrameNumber = mSlots[found].mFrameNumber;
+    item->mCrop = mSlots[found].mCrop;
+    item->mTransform = mSlots[found].mTransform;
+    item->mScalingMode = mSlots[found].mScalingMode;
+
+    CNW_LOGD("acquireBuffer: slot=%d frame=%llu", found,
+            (unsigned long long)item->mFrameNumber);
+    return OK;
+}
+
+status_t CameraNativeWindow::lockAcquiredBuffer(int slot, void** vaddr)
+{
+    Mutex::Autolock lock(mMutex);
+
+    if (slot < 0 || slot >= mBufferCount) {
+        CNW_LOGE("lockAcquiredBuffer: slot index out of range [0, %d]: %d",
+                mBufferCount, slot);
+        return BAD_VALUE;
+    } else if (mSlots[slot].mBufferState != BufferSlot::ACQUIRED) {
+        CNW_LOGE("lockAcquiredBuffer: slot %d is not owned by the consumer "
+                "(state=%d)", slot, mSlots[slot].mBufferState);
+        return BAD_VALUE;
+    }
+
+    if (mSlots[slot].mLocked) {
+        CNW_LOGE("lockAcquiredBuffer: slot %d is already locked", slot);
+        return INVALID_OPERATION;
+    }
+
+    status_t err = mSlots[slot].mGraphicBuffer->lock(
+            GraphicBuffer::USAGE_SW_READ_OFTEN, vaddr);
+    if (err != NO_ERROR) {
+        CNW_LOGE("lockAcquiredBuffer: lock failed with error %d", err);
+        return err;
+    }
+    mSlots[slot].mLocked = true;
+    return OK;
+}
+
+status_t CameraNativeWindow::releaseBuffer(int slot)
+{
+    Mutex::Autolock lock(mMutex);
+
+    if (slot < 0 || slot >= mBufferCount) {
+        CNW_LOGE("releaseBuffer: slot index out of range [0, %d]: %d",
+                mBufferCount, slot);
+        return BAD_VALUE;
+    } else if (mSlots[slot].mBufferState != BufferSlot::ACQUIRED) {
+        CNW_LOGE("releaseBuffer: slot %d is not owned by the consumer "
+                "(state=%d)", slot, mSlots[slot].mBufferState);
+        return BAD_VALUE;
+    }
+
+    if (mSlots[slot].mLocked) {
+        mSlots[slot].mGraphicBuffer->unlock();
+        mSlots[slot].mLocked = false;
+    }
+    mSlots[slot].mBufferState = BufferSlot::FREE;
+    mDequeueCondition.signal();
+    return OK;
+}
+
 int CameraNativeWindow::perform(int operation, va_list args)
 {
     int res = NO_ERROR;
@@ -361,8 +563,14 @@ int CameraNativeWindow::perform(int operation, va_list args)
         res = dispatchSetBuffersFormat(args);
         break;
     case NATIVE_WINDOW_SET_CROP:
+        res = dispatchSetCrop(args);
+        break;
     case NATIVE_WINDOW_SET_BUFFERS_TRANSFORM:
+        res = dispatchSetBuffersTransform(args);
+        break;
     case NATIVE_WINDOW_SET_SCALING_MODE:
+        res = dispatchSetScalingMode(args);
+        break;
     case NATIVE_WINDOW_LOCK:
     case NATIVE_WINDOW_UNLOCK_AND_POST:
     case NATIVE_WINDOW_API_CONNECT:
@@ -401,9 +609,140 @@ int CameraNativeWindow::query(int what, int* outValue) const
 
 int CameraNativeWindow::setSwapInterval(int interval)
 {
+    CNW_LOGD("CameraNativeWindow::setSwapInterval: interval=%d", interval);
+    Mutex::Autolock lock(mMutex);
+    mSynchronousMode = (interval != 0);
+    if (!mSynchronousMode) {
+        // waiters may now be able to recycle a queued buffer
+        mDequeueCondition.signal();
+    }
     return NO_ERROR;
 }
 
+status_t CameraNativeWindow::setDequeueTimeout(nsecs_t timeout)
+{
+    CNW_LOGD("CameraNativeWindow::setDequeueTimeout: timeout=%lld",
+            (long long)timeout);
+    Mutex::Autolock lock(mMutex);
+
+    if (timeout < 0)
+        return BAD_VALUE;
+
+    mDequeueTimeout = timeout;
+    return OK;
+}
+
+uint32_t CameraNativeWindow::getDequeueTimeoutCount() const
+{
+    Mutex::Autolock lock(mMutex);
+    return mDequeueTimeoutCount;
+}
+
+uint32_t CameraNativeWindow::getRecycledCount() const
+{
+    Mutex::Autolock lock(mMutex);
+    return mRecycledCount;
+}
+
+void CameraNativeWindow::dump(String8& result) const
+{
+    // Counters are plain words; a slightly stale read is fine here.
+    result.appendFormat("CameraNativeWindow %p: bufferCount=%d %dx%d fmt=%d "
+            "usage=0x%x sync=%d consumer=%d frames=%llu\n",
+            this, mBufferCount, mDefaultWidth, mDefaultHeight, mPixelFormat,
+            mUsage, mSynchronousMode, mConsumerEnabled,
+            (unsigned long long)mFrameCounter);
+    result.appendFormat("  dequeue timeouts=%u recycled=%u\n",
+            mDequeueTimeoutCount, mRecycledCount);
+
+    mDequeueWaitTime.dump(result, "dequeue wait");
+    mQueueInterval.dump(result, "queue interval");
+    mAllocTime.dump(result, "alloc");
+
+    char name[16];
+    for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+        if (mHoldTime[i].count() > 0) {
+            snprintf(name, sizeof(name), "hold[%d]", i);
+            mHoldTime[i].dump(result, name);
+        }
+    }
+}
+
+void CameraNativeWindow::resetTimings()
+{
+    for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+        mHoldTime[i].reset();
+    }
+    mDequeueWaitTime.reset();
+    mQueueInterval.reset();
+    mAllocTime.reset();
+}
+
+//================================================
+CameraNativeWindow::TimingHistogram::TimingHistogram()
+{
+    reset();
+}
+
+void CameraNativeWindow::TimingHistogram::record(nsecs_t duration)
+{
+    uint32_t us = duration > 0 ? uint32_t(duration / 1000) : 0;
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    android_atomic_inc(&mBuckets[bucket]);
+    android_atomic_inc(&mCount);
+
+    int32_t max = mMaxUs;
+    while (int32_t(us) > max) {
+        if (android_atomic_cmpxchg(max, int32_t(us), &mMaxUs) == 0) {
+            break;
+        }
+        max = mMaxUs;
+    }
+}
+
+void CameraNativeWindow::TimingHistogram::reset()
+{
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        android_atomic_and(0, &mBuckets[i]);
+    }
+    android_atomic_and(0, &mCount);
+    android_atomic_and(0, &mMaxUs);
+}
+
+uint32_t CameraNativeWindow::TimingHistogram::percentileUs(int32_t percentile) const
+{
+    const int64_t target = (int64_t(mCount) * percentile + 99) / 100;
+    int64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += mBuckets[i];
+        if (seen >= target) {
+            return 1u << i;
+        }
+    }
+    return 1u << (NUM_BUCKETS - 1);
+}
+
+void CameraNativeWindow::TimingHistogram::dump(String8& result, const char* name) const
+{
+    if (mCount == 0) {
+        result.appendFormat("  %-14s n=0\n", name);
+        return;
+    }
+    result.appendFormat("  %-14s n=%d max=%dus p50<%uus p90<%uus p99<%uus\n",
+            name, mCount, mMaxUs,
+            percentileUs(50), percentileUs(90), percentileUs(99));
+    result.append("                ");
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        if (mBuckets[i]) {
+            result.appendFormat(" <%uus:%d", 1u << i, mBuckets[i]);
+        }
+    }
+    result.append("\n");
+}
+
 //================================================
 int CameraNativeWindow::dispatchSetUsage(va_list args)
 {
@@ -448,6 +787,30 @@ int CameraNativeWindow::dispatchSetBuffersTimestamp(va_list args)
     return setBuffersTimestamp(timestamp);
 }
 
+int CameraNativeWindow::dispatchSetCrop(va_list args)
+{
+    android_native_rect_t const* rect = va_arg(args, android_native_rect_t*);
+    Rect crop;
+    if (rect == NULL) {
+        crop.makeInvalid();
+    } else {
+        crop = Rect(rect->left, rect->top, rect->right, rect->bottom);
+    }
+    return setCrop(crop);
+}
+
+int CameraNativeWindow::dispatchSetBuffersTransform(va_list args)
+{
+    int transform = va_arg(args, int);
+    return setBuffersTransform(transform);
+}
+
+int CameraNativeWindow::dispatchSetScalingMode(va_list args)
+{
+    int mode = va_arg(args, int);
+    return setScalingMode(mode);
+}
+
 //================================================
 int CameraNativeWindow::setUsage(uint32_t reqUsage)
 {
@@ -494,3 +857,58 @@ int CameraNativeWindow::setBuffersTimestamp(int64_t timestamp)
     mTimestamp = timestamp;
     return OK;
 }
+
+int CameraNativeWindow::setCrop(const Rect& crop)
+{
+    CNW_LOGD("CameraNativeWindow::setCrop: %d,%d-%d,%d",
+            crop.left, crop.top, crop.right, crop.bottom);
+    Mutex::Autolock lock(mMutex);
+
+    // an empty rectangle means "use the whole buffer"
+    if (crop.isEmpty()) {
+        mNextCrop.makeInvalid();
+        return OK;
+    }
+
+    if (crop.left < 0 || crop.top < 0)
+        return BAD_VALUE;
+
+    if (mDefaultWidth && mDefaultHeight &&
+            (uint32_t(crop.right) > mDefaultWidth ||
+             uint32_t(crop.bottom) > mDefaultHeight))
+        return BAD_VALUE;
+
+    mNextCrop = crop;
+    return OK;
+}
+
+int CameraNativeWindow::setBuffersTransform(uint32_t transform)
+{
+    CNW_LOGD("CameraNativeWindow::setBuffersTransform: 0x%x", transform);
+    Mutex::Autolock lock(mMutex);
+
+    if (transform & ~uint32_t(NATIVE_WINDOW_TRANSFORM_FLIP_H |
+                              NATIVE_WINDOW_TRANSFORM_FLIP_V |
+                              NATIVE_WINDOW_TRANSFORM_ROT_90))
+        return BAD_VALUE;
+
+    mNextTransform = transform;
+    return OK;
+}
+
+int CameraNativeWindow::setScalingMode(int mode)
+{
+    CNW_LOGD("CameraNativeWindow::setScalingMode: %d", mode);
+    Mutex::Autolock lock(mMutex);
+
+    switch (mode) {
+    case NATIVE_WINDOW_SCALING_MODE_FREEZE:
+    case NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW:
+        break;
+    default:
+        return BAD_VALUE;
+    }
+
+    mNextScalingMode = mode;
+    return OK;
+}
@@ -9,7 +9,11 @@
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 
+#ifdef CNW_HOST_BUFFERS
+#include "HostGraphicBuffer.h"
+#else
 #include <ui/GraphicBuffer.h>
+#endif
 #include <ui/Rect.h>
 #include <utils/String8.h>
 #include <utils/threads.h>
@@ -25,6 +29,47 @@ public:
         MIN_BUFFER_SLOTS  = MIN_UNDEQUEUED_BUFFERS
     };
     enum { NUM_BUFFER_SLOTS = 32 };
+    enum { INVALID_BUFFER_SLOT = -1 };
+
+    // BufferItem describes a queued buffer handed to the consumer by
+    // acquireBuffer. The consumer owns the slot until it calls releaseBuffer.
+    struct BufferItem {
+
+        BufferItem()
+            : mGraphicBuffer(0),
+              mSlot(INVALID_BUFFER_SLOT),
+              mTimestamp(0),
+              mFrameNumber(0),
+              mTransform(0),
+              mScalingMode(NATIVE_WINDOW_SCALING_MODE_FREEZE) {
+            mCrop.makeInvalid();
+        }
+
+        // mGraphicBuffer is the acquired buffer. Holding this reference keeps
+        // the gralloc memory alive even if the slot is freed underneath us.
+        sp<GraphicBuffer> mGraphicBuffer;
+
+        // mSlot is the slot index to pass to lockAcquiredBuffer and
+        // releaseBuffer.
+        int mSlot;
+
+        // mTimestamp is the timestamp the producer attached in queueBuffer.
+        int64_t mTimestamp;
+
+        // mFrameNumber is the queue order of this frame.
+        uint64_t mFrameNumber;
+
+        // mCrop is the region of the buffer the producer filled in. It is
+        // invalid (empty) when the whole buffer should be used.
+        Rect mCrop;
+
+        // mTransform is the NATIVE_WINDOW_TRANSFORM_* flags the consumer
+        // should apply when reading the buffer.
+        uint32_t mTransform;
+
+        // mScalingMode is the NATIVE_WINDOW_SCALING_MODE_* for this buffer.
+        int mScalingMode;
+    };
 
     CameraNativeWindow();
     ~CameraNativeWindow(); // this class cannot be overloaded
@@ -38,6 +83,47 @@ public:
     static int hook_queueBuffer(ANativeWindow* window, ANativeWindowBuffer* buffer);
     static int hook_setSwapInterval(ANativeWindow* window, int interval);
 
+    // Consumer side. Queued buffers are only retained for a consumer once
+    // setConsumerEnabled(true) has been called; otherwise they are recycled
+    // immediately, as the HAL is the only user of the window. Enable the
+    // consumer before preview starts so buffers get allocated with CPU read
+    // usage.
+    status_t setConsumerEnabled(bool enabled);
+
+    // acquireBuffer hands the most recently queued buffer to the consumer.
+    // Older queued buffers are dropped back to FREE, since the consumer only
+    // cares about the newest frame. Returns WOULD_BLOCK if nothing is queued.
+    status_t acquireBuffer(BufferItem* item);
+
+    // lockAcquiredBuffer maps an acquired buffer for CPU reads. The mapping
+    // stays valid until releaseBuffer is called for the slot.
+    status_t lockAcquiredBuffer(int slot, void** vaddr);
+
+    // releaseBuffer returns an acquired buffer to the producer, unlocking it
+    // first if it was locked.
+    status_t releaseBuffer(int slot);
+
+    // setDequeueTimeout bounds how long dequeueBuffer may wait for a buffer.
+    // When the timeout expires dequeueBuffer returns -EBUSY instead of
+    // blocking the HAL's preview thread. A timeout of 0 waits forever.
+    status_t setDequeueTimeout(nsecs_t timeout);
+
+    // getDequeueTimeoutCount returns the number of dequeueBuffer calls that
+    // gave up after the dequeue timeout expired.
+    uint32_t getDequeueTimeoutCount() const;
+
+    // getRecycledCount returns the number of queued buffers reclaimed by
+    // dequeueBuffer in asynchronous mode before the consumer saw them.
+    uint32_t getRecycledCount() const;
+
+    // dump appends the buffer queue counters and timing histograms to result.
+    // It does not take mMutex, so it can be called while preview is running
+    // without stalling the HAL.
+    void dump(String8& result) const;
+
+    // resetTimings clears all timing histograms.
+    void resetTimings();
+
 protected:
 
     virtual int cancelBuffer(ANativeWindowBuffer* buffer);
@@ -53,6 +139,9 @@ protected:
     virtual int setBuffersFormat(int format);
     virtual int setBuffersTimestamp(int64_t timestamp);
     virtual int setUsage(uint32_t reqUsage);
+    virtual int setCrop(const Rect& crop);
+    virtual int setBuffersTransform(uint32_t transform);
+    virtual int setScalingMode(int mode);
 
     // freeBufferLocked frees the resources (both GraphicBuffer and EGLImage)
     // for the given slot.
@@ -71,11 +160,37 @@ private:
     int dispatchSetBuffersFormat(va_list args);
     int dispatchSetBuffersTimestamp(va_list args);
     int dispatchSetUsage(va_list args);
+    int dispatchSetCrop(va_list args);
+    int dispatchSetBuffersTransform(va_list args);
+    int dispatchSetScalingMode(va_list args);
 
     int getSlotFromBufferLocked(android_native_buffer_t* buffer) const;
 
 private:
-    enum { INVALID_BUFFER_SLOT = -1 };
+    // TimingHistogram is a fixed-size histogram of durations. Bucket 0 holds
+    // samples below 1us and bucket i holds samples in [2^(i-1), 2^i) us, with
+    // the last bucket catching everything larger. record() only performs
+    // atomic increments so it never blocks the caller.
+    class TimingHistogram {
+    public:
+        enum { NUM_BUCKETS = 22 };
+
+        TimingHistogram();
+
+        void record(nsecs_t duration);
+        void reset();
+        int32_t count() const { return mCount; }
+        void dump(String8& result, const char* name) const;
+
+    private:
+        // percentileUs returns the upper bound, in us, of the bucket holding
+        // the given percentile of the samples.
+        uint32_t percentileUs(int32_t percentile) const;
+
+        volatile int32_t mBuckets[NUM_BUCKETS];
+        volatile int32_t mCount;
+        volatile int32_t mMaxUs;
+    };
 
     struct BufferSlot {
 
@@ -83,7 +198,12 @@ private:
             : mGraphicBuffer(0),
               mBufferState(BufferSlot::FREE),
               mTimestamp(0),
-              mFrameNumber(0){
+              mFrameNumber(0),
+              mLocked(false),
+              mDequeueTime(0),
+              mTransform(0),
+              mScalingMode(NATIVE_WINDOW_SCALING_MODE_FREEZE) {
+            mCrop.makeInvalid();
         }
 
         // mGraphicBuffer points to the buffer allocated for this slot or is NULL
@@ -118,6 +238,11 @@ private:
             // circumstances. See the note about the current buffer in the
             // documentation for DEQUEUED.
             QUEUED = 2,
+
+            // ACQUIRED indicates that the buffer has been handed to the
+            // consumer by acquireBuffer and has not yet been released. Neither
+            // the client nor the window may reuse it until releaseBuffer.
+            ACQUIRED = 3,
         };
 
         // mBufferState is the current state of this buffer slot.
@@ -129,6 +254,26 @@ private:
 
         // mFrameNumber is the number of the queued frame for this slot.
         uint64_t mFrameNumber;
+
+        // mLocked is true while the consumer holds a CPU mapping of an
+        // ACQUIRED buffer.
+        bool mLocked;
+
+        // mDequeueTime is when the client last dequeued this slot, used to
+        // measure how long the client holds on to it.
+        nsecs_t mDequeueTime;
+
+        // mCrop is the crop rectangle that was current when this slot was
+        // queued. It gets set by queueBuffer each time this slot is queued.
+        Rect mCrop;
+
+        // mTransform is the buffer transform that was current when this slot
+        // was queued.
+        uint32_t mTransform;
+
+        // mScalingMode is the scaling mode that was current when this slot
+        // was queued.
+        int mScalingMode;
     };
 
     // mSlots is the array of buffer slots that must be mirrored on the client
@@ -141,6 +286,38 @@ private:
     // mDequeueCondition condition used for dequeueBuffer in synchronous mode
     mutable Condition mDequeueCondition;
 
+    // mSynchronousMode whether we're in synchronous mode or not. It is
+    // cleared by setSwapInterval(0), after which dequeueBuffer recycles the
+    // oldest queued buffer rather than waiting for the consumer.
+    bool mSynchronousMode;
+
+    // mDequeueTimeout is the longest dequeueBuffer waits for a free buffer,
+    // or 0 to wait forever.
+    nsecs_t mDequeueTimeout;
+
+    // mDequeueTimeoutCount counts the dequeueBuffer calls that timed out.
+    uint32_t mDequeueTimeoutCount;
+
+    // mRecycledCount counts the queued buffers reclaimed in asynchronous mode.
+    uint32_t mRecycledCount;
+
+    // mHoldTime records, per slot, the time between dequeueBuffer and
+    // queueBuffer, i.e. how long the HAL spends filling the buffer.
+    TimingHistogram mHoldTime[NUM_BUFFER_SLOTS];
+
+    // mDequeueWaitTime records the time dequeueBuffer spends blocked on
+    // mDequeueCondition waiting for the consumer.
+    TimingHistogram mDequeueWaitTime;
+
+    // mQueueInterval records the time between consecutive queueBuffer calls.
+    TimingHistogram mQueueInterval;
+
+    // mAllocTime records the time taken to allocate a GraphicBuffer.
+    TimingHistogram mAllocTime;
+
+    // mLastQueueTime is when the last buffer was queued, or 0.
+    nsecs_t mLastQueueTime;
+
     // mTimestamp is the timestamp that will be used for the next buffer queue
     // operation. It defaults to NATIVE_WINDOW_TIMESTAMP_AUTO, which means that
     // a timestamp is auto-generated when queueBuffer is called.
@@ -161,6 +338,18 @@ private:
     // usage flag
     uint32_t mUsage;
 
+    // mNextCrop is the crop rectangle that will be used for the next buffer
+    // that gets queued. It is set by calling setCrop.
+    Rect mNextCrop;
+
+    // mNextTransform is the transform identifier that will be used for the
+    // next buffer that gets queued. It is set by calling setBuffersTransform.
+    uint32_t mNextTransform;
+
+    // mNextScalingMode is the scaling mode that will be used for the next
+    // buffer that gets queued. It is set by calling setScalingMode.
+    int mNextScalingMode;
+
     // mBufferCount is the number of buffer slots that the client and server
     // must maintain. It defaults to MIN_ASYNC_BUFFER_SLOTS and can be changed
     // by calling setBufferCount or setBufferCountServer
@@ -172,6 +361,10 @@ private:
 
     // mFrameCounter is the free running counter, incremented for every buffer queued
     uint64_t mFrameCounter;
+
+    // mConsumerEnabled is true when a consumer acquires queued buffers. When
+    // false, queued buffers go straight back to FREE.
+    bool mConsumerEnabled;
 };
 
 }; // namespace android
@@ -0,0 +1,262 @@
+// Generated by gen_camera_parameter_keys.py; do not edit.
+
+#ifndef __CAMERA_PARAMETER_KEYS_H
+#define __CAMERA_PARAMETER_KEYS_H
+
+#include <stdint.h>
+#include <string.h>
+
+namespace android {
+
+// CameraParameterKey gives every well-known CameraParameters key a dense
+// id, so that parsed parameters can be indexed by key in O(1), and maps
+// key strings to ids with a perfect hash.
+struct CameraParameterKey
+{
+    enum Id {
+        KEY_PREVIEW_SIZE = 0,
+        KEY_SUPPORTED_PREVIEW_SIZES = 1,
+        KEY_PREVIEW_FPS_RANGE = 2,
+        KEY_SUPPORTED_PREVIEW_FPS_RANGE = 3,
+        KEY_PREVIEW_FORMAT = 4,
+        KEY_SUPPORTED_PREVIEW_FORMATS = 5,
+        KEY_PREVIEW_FRAME_RATE = 6,
+        KEY_SUPPORTED_PREVIEW_FRAME_RATES = 7,
+        KEY_PICTURE_SIZE = 8,
+        KEY_SUPPORTED_PICTURE_SIZES = 9,
+        KEY_PICTURE_FORMAT = 10,
+        KEY_SUPPORTED_PICTURE_FORMATS = 11,
+        KEY_JPEG_THUMBNAIL_WIDTH = 12,
+        KEY_JPEG_THUMBNAIL_HEIGHT = 13,
+        KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES = 14,
+        KEY_JPEG_THUMBNAIL_QUALITY = 15,
+        KEY_JPEG_QUALITY = 16,
+        KEY_ROTATION = 17,
+        KEY_GPS_LATITUDE = 18,
+        KEY_GPS_LONGITUDE = 19,
+        KEY_GPS_ALTITUDE = 20,
+        KEY_GPS_TIMESTAMP = 21,
+        KEY_GPS_PROCESSING_METHOD = 22,
+        KEY_WHITE_BALANCE = 23,
+        KEY_SUPPORTED_WHITE_BALANCE = 24,
+        KEY_EFFECT = 25,
+        KEY_SUPPORTED_EFFECTS = 26,
+        KEY_ANTIBANDING = 27,
+        KEY_SUPPORTED_ANTIBANDING = 28,
+        KEY_SCENE_MODE = 29,
+        KEY_SUPPORTED_SCENE_MODES = 30,
+        KEY_FLASH_MODE = 31,
+        KEY_SUPPORTED_FLASH_MODES = 32,
+        KEY_FOCUS_MODE = 33,
+        KEY_SUPPORTED_FOCUS_MODES = 34,
+        KEY_FOCAL_LENGTH = 35,
+        KEY_HORIZONTAL_VIEW_ANGLE = 36,
+        KEY_VERTICAL_VIEW_ANGLE = 37,
+        KEY_EXPOSURE_COMPENSATION = 38,
+        KEY_MAX_EXPOSURE_COMPENSATION = 39,
+        KEY_MIN_EXPOSURE_COMPENSATION = 40,
+        KEY_EXPOSURE_COMPENSATION_STEP = 41,
+        KEY_ZOOM = 42,
+        KEY_MAX_ZOOM = 43,
+        KEY_ZOOM_RATIOS = 44,
+        KEY_ZOOM_SUPPORTED = 45,
+        KEY_SMOOTH_ZOOM_SUPPORTED = 46,
+        KEY_FOCUS_DISTANCES = 47,
+        KEY_VIDEO_FRAME_FORMAT = 48,
+        KEY_AUTO_EXPOSURE_LOCK = 49,
+        KEY_AUTO_EXPOSURE_LOCK_SUPPORTED = 50,
+        KEY_AUTO_WHITEBALANCE_LOCK = 51,
+        KEY_AUTO_WHITEBALANCE_LOCK_SUPPORTED = 52,
+        KEY_MAX_NUM_FOCUS_AREAS = 53,
+        KEY_FOCUS_AREAS = 54,
+        KEY_MAX_NUM_METERING_AREAS = 55,
+        KEY_METERING_AREAS = 56,
+        KEY_VIDEO_SIZE = 57,
+        KEY_SUPPORTED_VIDEO_SIZES = 58,
+        KEY_PREFERRED_PREVIEW_SIZE_FOR_VIDEO = 59,
+        KEY_MAX_NUM_DETECTED_FACES_HW = 60,
+        KEY_MAX_NUM_DETECTED_FACES_SW = 61,
+        KEY_RECORDING_HINT = 62,
+        KEY_VIDEO_SNAPSHOT_SUPPORTED = 63,
+        KEY_VIDEO_STABILIZATION = 64,
+        KEY_VIDEO_STABILIZATION_SUPPORTED = 65,
+        COUNT = 66,
+        UNKNOWN = -1
+    };
+
+    static const char* name(Id id) {
+        static const char* const sNames[COUNT] = {
+            "preview-size",
+            "preview-size-values",
+            "preview-fps-range",
+            "preview-fps-range-values",
+            "preview-format",
+            "preview-format-values",
+            "preview-frame-rate",
+            "preview-frame-rate-values",
+            "picture-size",
+            "picture-size-values",
+            "picture-format",
+            "picture-format-values",
+            "jpeg-thumbnail-width",
+            "jpeg-thumbnail-height",
+            "jpeg-thumbnail-size-values",
+            "jpeg-thumbnail-quality",
+            "jpeg-quality",
+            "rotation",
+            "gps-latitude",
+            "gps-longitude",
+            "gps-altitude",
+            "gps-timestamp",
+            "gps-processing-method",
+            "whitebalance",
+            "whitebalance-values",
+            "effect",
+            "effect-values",
+            "antibanding",
+            "antibanding-values",
+            "scene-mode",
+            "scene-mode-values",
+            "flash-mode",
+            "flash-mode-values",
+            "focus-mode",
+            "focus-mode-values",
+            "focal-length",
+            "horizontal-view-angle",
+            "vertical-view-angle",
+            "exposure-compensation",
+            "max-exposure-compensation",
+            "min-exposure-compensation",
+            "exposure-compensation-step",
+            "zoom",
+            "max-zoom",
+            "zoom-ratios",
+            "zoom-supported",
+            "smooth-zoom-supported",
+            "focus-distances",
+            "video-frame-format",
+            "auto-exposure-lock",
+            "auto-exposure-lock-supported",
+            "auto-whitebalance-lock",
+            "auto-whitebalance-lock-supported",
+            "max-num-focus-areas",
+            "focus-areas",
+            "max-num-metering-areas",
+            "metering-areas",
+            "video-size",
+            "video-size-values",
+            "preferred-preview-size-for-video",
+            "max-num-detected-faces-hw",
+            "max-num-detected-faces-sw",
+            "recording-hint",
+            "video-snapshot-supported",
+            "video-stabilization",
+            "video-stabilization-supported",
+        };
+        return sNames[id];
+    }
+
+    // lookup returns the id of key, or UNKNOWN for any other string.
+    static Id lookup(const char* key) {
+        static const int8_t sSlots[512] = {
+            -1, -1, -1, -1, -1, 27, -1, 54, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, 42, -1, -1, -1, -1, -1, 9, 10, -1,
+            -1, -1, -1, -1, 24, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, 15, -1, -1, -1, 57, -1, -1, -1, -1, -1, 13, -1, -1,
+            4, -1, -1, -1, 45, -1, -1, -1, -1, -1, -1, -1, -1, 21, -1, 51,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, 46, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 43, -1, -1, -1, 16, -1,
+            -1, -1, -1, -1, -1, -1, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, 34, -1, -1, -1, -1, -1, -1,
+            -1, 20, -1, 62, -1, 49, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, 56, -1, 55, -1, -1, -1, -1, -1, 61, 48, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 60, -1, -1, -1, -1,
+            -1, -1, 12, -1, -1, -1, -1, -1, -1, 6, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, 58, -1, -1, 3, -1, -1, -1, -1, -1, -1, 28, 18,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 36, -1, -1, -1,
+            -1, -1, -1, 41, 35, -1, -1, -1, -1, -1, -1, -1, -1, -1, 38, -1,
+            -1, 53, -1, -1, -1, -1, 26, 23, -1, 64, -1, -1, 29, -1, 50, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 31, -1,
+            -1, -1, -1, -1, -1, -1, 59, -1, 19, -1, -1, 40, -1, -1, -1, -1,
+            -1, -1, 65, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1,
+            8, -1, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1, 52, -1, -1, 32,
+            -1, 39, 22, -1, -1, -1, -1, -1, -1, 63, 37, -1, -1, 25, -1, -1,
+            -1, -1, 44, -1, -1, -1, -1, -1, -1, -1, -1, -1, 33, -1, -1, -1,
+            -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 5, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, 30, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 47, -1, -1,
+        };
+        uint32_t h = 180u;
+        for (const char* p = key; *p; p++) {
+            h = (h ^ (uint8_t)*p) * 16777619u;
+        }
+        int slot = sSlots[h & 511];
+        if (slot < 0 || strcmp(key, name(Id(slot))) != 0) {
+            return UNKNOWN;
+        }
+        return Id(slot);
+    }
+};
+
+// X-macro over the ids that have a CameraParameters::KEY_ constant of the
+// same name.
+#define CAMERA_PARAMETER_KEY_CONSTANTS(X) \
+    X(KEY_PREVIEW_SIZE) \
+    X(KEY_SUPPORTED_PREVIEW_SIZES) \
+    X(KEY_PREVIEW_FPS_RANGE) \
+    X(KEY_SUPPORTED_PREVIEW_FPS_RANGE) \
+    X(KEY_PREVIEW_FORMAT) \
+    X(KEY_SUPPORTED_PREVIEW_FORMATS) \
+    X(KEY_PREVIEW_FRAME_RATE) \
+    X(KEY_SUPPORTED_PREVIEW_FRAME_RATES) \
+    X(KEY_PICTURE_SIZE) \
+    X(KEY_SUPPORTED_PICTURE_SIZES) \
+    X(KEY_PICTURE_FORMAT) \
+    X(KEY_SUPPORTED_PICTURE_FORMATS) \
+    X(KEY_JPEG_THUMBNAIL_WIDTH) \
+    X(KEY_JPEG_THUMBNAIL_HEIGHT) \
+    X(KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES) \
+    X(KEY_JPEG_THUMBNAIL_QUALITY) \
+    X(KEY_JPEG_QUALITY) \
+    X(KEY_ROTATION) \
+    X(KEY_GPS_LATITUDE) \
+    X(KEY_GPS_LONGITUDE) \
+    X(KEY_GPS_ALTITUDE) \
+    X(KEY_GPS_TIMESTAMP) \
+    X(KEY_GPS_PROCESSING_METHOD) \
+    X(KEY_WHITE_BALANCE) \
+    X(KEY_SUPPORTED_WHITE_BALANCE) \
+    X(KEY_EFFECT) \
+    X(KEY_SUPPORTED_EFFECTS) \
+    X(KEY_ANTIBANDING) \
+    X(KEY_SUPPORTED_ANTIBANDING) \
+    X(KEY_SCENE_MODE) \
+    X(KEY_SUPPORTED_SCENE_MODES) \
+    X(KEY_FLASH_MODE) \
+    X(KEY_SUPPORTED_FLASH_MODES) \
+    X(KEY_FOCUS_MODE) \
+    X(KEY_SUPPORTED_FOCUS_MODES) \
+    X(KEY_FOCAL_LENGTH) \
+    X(KEY_HORIZONTAL_VIEW_ANGLE) \
+    X(KEY_VERTICAL_VIEW_ANGLE) \
+    X(KEY_EXPOSURE_COMPENSATION) \
+    X(KEY_MAX_EXPOSURE_COMPENSATION) \
+    X(KEY_MIN_EXPOSURE_COMPENSATION) \
+    X(KEY_EXPOSURE_COMPENSATION_STEP) \
+    X(KEY_ZOOM) \
+    X(KEY_MAX_ZOOM) \
+    X(KEY_ZOOM_RATIOS) \
+    X(KEY_ZOOM_SUPPORTED) \
+    X(KEY_SMOOTH_ZOOM_SUPPORTED) \
+    X(KEY_FOCUS_DISTANCES) \
+    X(KEY_VIDEO_FRAME_FORMAT)
+
+}; // namespace android
+
+#endif // __CAMERA_PARAMETER_KEYS_H
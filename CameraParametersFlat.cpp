@@ -0,0 +1,214 @@
+#include "CameraParametersFlat.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace android;
+
+
+FlatCameraParameters::FlatCameraParameters()
+    : mArena(0), mEntries(0), mCount(0)
+{
+    memset(mKnown, 0xff, sizeof(mKnown));
+}
+
+FlatCameraParameters::FlatCameraParameters(const char* flattened)
+    : mArena(0), mEntries(0), mCount(0)
+{
+    memset(mKnown, 0xff, sizeof(mKnown));
+    parse(flattened);
+}
+
+FlatCameraParameters::~FlatCameraParameters()
+{
+    clear();
+}
+
+void FlatCameraParameters::clear()
+{
+    free(mArena);
+    mArena = 0;
+    mEntries = 0;
+    mCount = 0;
+    memset(mKnown, 0xff, sizeof(mKnown));
+}
+
+status_t FlatCameraParameters::parse(const char* flattened)
+{
+    clear();
+    if (!flattened) {
+        return NO_ERROR;
+    }
+
+    // Every entry has an '=', so their number bounds the table size.
+    size_t length = 0;
+    size_t maxEntries = 0;
+    for (const char* p = flattened; *p; p++) {
+        maxEntries += *p == '=';
+        length++;
+    }
+    // mKnown holds 16-bit indices.
+    if (maxEntries > 0x7fff) {
+        return BAD_VALUE;
+    }
+    if (maxEntries == 0) {
+        return NO_ERROR;
+    }
+
+    mArena = malloc(maxEntries * sizeof(Entry) + length + 1);
+    if (!mArena) {
+        return NO_MEMORY;
+    }
+    mEntries = static_cast<Entry*>(mArena);
+    char* text = reinterpret_cast<char*>(mEntries + maxEntries);
+    memcpy(text, flattened, length + 1);
+
+    // Same splitting rules as CameraParameters::unflatten: a key runs up to
+    // the next '=', its value up to the next ';' or the end of the string.
+    char* a = text;
+    for (;;) {
+        char* b = strchr(a, '=');
+        if (!b) {
+            break;
+        }
+        *b = '\0';
+        Entry& e = mEntries[mCount];
+        e.key = a;
+        e.value = b + 1;
+        e.order = mCount;
+        mCount++;
+
+        a = b + 1;
+        b = strchr(a, ';');
+        if (!b) {
+            break;
+        }
+        *b = '\0';
+        a = b + 1;
+    }
+
+    qsort(mEntries, mCount, sizeof(Entry), compareEntries);
+
+    // Drop all but the last of any run of equal keys.
+    size_t out = 0;
+    for (size_t i = 0; i < mCount; i++) {
+        if (i + 1 < mCount && strcmp(mEntries[i].key, mEntries[i + 1].key) == 0) {
+            continue;
+        }
+        CameraParameterKey::Id id = CameraParameterKey::lookup(mEntries[i].key);
+        if (id != CameraParameterKey::UNKNOWN) {
+            mKnown[id] = out;
+        }
+        mEntries[out++] = mEntries[i];
+    }
+    mCount = out;
+    return NO_ERROR;
+}
+
+int FlatCameraParameters::compareEntries(const void* lhs, const void* rhs)
+{
+    const Entry* l = static_cast<const Entry*>(lhs);
+    const Entry* r = static_cast<const Entry*>(rhs);
+    int c = strcmp(l->key, r->key);
+    if (c) {
+        return c;
+    }
+    return l->order < r->order ? -1 : l->order > r->order;
+}
+
+ssize_t FlatCameraParameters::indexOf(const char* key) const
+{
+    size_t lo = 0;
+    size_t hi = mCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(key, mEntries[mid].key);
+        if (c == 0) {
+            return mid;
+        }
+        if (c < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+const char* FlatCameraParameters::get(const char* key) const
+{
+    // Vendor keys miss the hash and fall back to the binary search.
+    CameraParameterKey::Id id = CameraParameterKey::lookup(key);
+    if (id != CameraParameterKey::UNKNOWN) {
+        return get(id);
+    }
+    ssize_t index = indexOf(key);
+    return index < 0 ? 0 : mEntries[index].value;
+}
+
+int FlatCameraParameters::toInt(const char* value)
+{
+    if (value == 0) {
+        return -1;
+    }
+    return strtol(value, 0, 0);
+}
+
+float FlatCameraParameters::toFloat(const char* value)
+{
+    if (value == 0) {
+        return -1;
+    }
+    return strtof(value, 0);
+}
+
+int FlatCameraParameters::getInt(const char* key) const
+{
+    return toInt(get(key));
+}
+
+float FlatCameraParameters::getFloat(const char* key) const
+{
+    return toFloat(get(key));
+}
+
+int FlatCameraParameters::getInt(CameraParameterKey::Id key) const
+{
+    return toInt(get(key));
+}
+
+float FlatCameraParameters::getFloat(CameraParameterKey::Id key) const
+{
+    return toFloat(get(key));
+}
+
+String8 FlatCameraParameters::flatten() const
+{
+    size_t length = 0;
+    for (size_t i = 0; i < mCount; i++) {
+        length += strlen(mEntries[i].key) + 1 + strlen(mEntries[i].value) + 1;
+    }
+    if (length) {
+        length--;   // no ';' after the last entry
+    }
+
+    String8 result;
+    char* p = result.lockBuffer(length);
+    if (!p) {
+        return result;
+    }
+    for (size_t i = 0; i < mCount; i++) {
+        size_t n = strlen(mEntries[i].key);
+        memcpy(p, mEntries[i].key, n);
+        p += n;
+        *p++ = '=';
+        n = strlen(mEntries[i].value);
+        memcpy(p, mEntries[i].value, n);
+        p += n;
+        if (i + 1 < mCount) {
+            *p++ = ';';
+        }
+    }
+    result.unlockBuffer(length);
+    return result;
+}
@@ -0,0 +1,93 @@
+#ifndef __CAMERA_PARAMETERS_FLAT_H
+#define __CAMERA_PARAMETERS_FLAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+
+#include "CameraParameterKeys.h"
+
+namespace android {
+
+// FlatCameraParameters is a read-only view of a flattened CameraParameters
+// string ("key1=value1;key2=value2;..."), as returned by a HAL's
+// get_parameters.
+//
+// CameraParameters::unflatten creates a String8 for every key and value and
+// inserts each pair into a sorted vector, which is quadratic in the number of
+// keys. parse() instead copies the string once into a single allocation that
+// also holds the entry table, cuts it up in place and sorts the table. The
+// result matches unflatten exactly, including a repeated key keeping its last
+// value, so flatten() returns the same string CameraParameters would.
+//
+// Well-known keys are also indexed by CameraParameterKey::Id, so that looking
+// one of them up is a table access rather than a binary search.
+class FlatCameraParameters
+{
+public:
+    FlatCameraParameters();
+    explicit FlatCameraParameters(const char* flattened);
+    ~FlatCameraParameters();
+
+    // parse replaces the current contents with those of flattened. It
+    // returns NO_MEMORY, leaving the object empty, if the allocation fails.
+    status_t parse(const char* flattened);
+    void clear();
+
+    size_t size() const { return mCount; }
+
+    // Entries are sorted by key, in strcmp order.
+    const char* keyAt(size_t index) const { return mEntries[index].key; }
+    const char* valueAt(size_t index) const { return mEntries[index].value; }
+
+    // indexOf returns the index of key, or -1 if there is no such key.
+    ssize_t indexOf(const char* key) const;
+
+    // get, getInt and getFloat behave like their CameraParameters
+    // counterparts: NULL or -1 for a missing key.
+    const char* get(const char* key) const;
+    int getInt(const char* key) const;
+    float getFloat(const char* key) const;
+
+    // The same, in O(1) for a well-known key.
+    const char* get(CameraParameterKey::Id key) const {
+        int index = mKnown[key];
+        return index < 0 ? 0 : mEntries[index].value;
+    }
+    int getInt(CameraParameterKey::Id key) const;
+    float getFloat(CameraParameterKey::Id key) const;
+
+    String8 flatten() const;
+
+private:
+    // Not copyable; the entries point into mArena.
+    FlatCameraParameters(const FlatCameraParameters&);
+    FlatCameraParameters& operator=(const FlatCameraParameters&);
+
+    struct Entry {
+        const char* key;
+        const char* value;
+        // order is the position in the input, so that of two equal keys
+        // the later one wins.
+        uint32_t order;
+    };
+
+    static int compareEntries(const void* lhs, const void* rhs);
+    static int toInt(const char* value);
+    static float toFloat(const char* value);
+
+    // mArena is the only allocation: the entry table followed by the copy
+    // of the input string that the entries point into.
+    void* mArena;
+    Entry* mEntries;
+    size_t mCount;
+
+    // mKnown maps each CameraParameterKey::Id to its entry, or -1.
+    int16_t mKnown[CameraParameterKey::COUNT];
+};
+
+}; // namespace android
+
+#endif // __CAMERA_PARAMETERS_FLAT_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_CAMERA_PREVIEW_WINDOW_H
+#define ANDROID_HARDWARE_CAMERA_PREVIEW_WINDOW_H
+
+#include <system/window.h>
+#include <hardware/camera.h>
+
+namespace android {
+
+#ifndef container_of
+#define container_of(ptr, type, member) ({                      \
+		const typeof(((type *) 0)->member) *__mptr = (ptr);     \
+		(type *) ((char *) __mptr - (char *)(&((type *)0)->member)); })
+#endif
+
+/**
+ * The preview_stream_ops table handed to an ICS camera HAL, forwarding each
+ * operation to an ANativeWindow.  It lives outside of
+ * CameraHardwareInterfaceICS.h so that the buffer path can be driven without
+ * a HAL, e.g. by the host-side CameraNativeWindow benchmark.
+ */
+struct camera_preview_window {
+	struct preview_stream_ops nw;
+	ANativeWindow *window;
+};
+
+class CameraPreviewWindow {
+public:
+	/** Fill in the preview_stream_ops hooks of w. */
+	static void init(struct camera_preview_window *w)
+	{
+		w->nw.cancel_buffer = __cancel_buffer;
+		w->nw.lock_buffer = __lock_buffer;
+		w->nw.dequeue_buffer = __dequeue_buffer;
+		w->nw.enqueue_buffer = __enqueue_buffer;
+		w->nw.set_buffer_count = __set_buffer_count;
+		w->nw.set_buffers_geometry = __set_buffers_geometry;
+		w->nw.set_crop = __set_crop;
+		w->nw.set_usage = __set_usage;
+		w->nw.set_swap_interval = __set_swap_interval;
+
+		w->nw.get_min_undequeued_buffer_count =
+				__get_min_undequeued_buffer_count;
+		w->window = 0;
+	}
+
+private:
+#define anw(n) (((struct camera_preview_window *)n)->window)
+
+	static int __dequeue_buffer(struct preview_stream_ops* w,
+								buffer_handle_t** buffer, int *stride)
+	{
+		int rc;
+		ANativeWindow *a = anw(w);
+		ANativeWindowBuffer* anb;
+		rc = a->dequeueBuffer(a, &anb);
+		if (!rc) {
+			*buffer = &anb->handle;
+			*stride = anb->stride;
+		}
+		return rc;
+	}
+
+	static int __lock_buffer(struct preview_stream_ops* w,
+					  buffer_handle_t* buffer)
+	{
+		ANativeWindow *a = anw(w);
+		return a->lockBuffer(a,
+				  container_of(buffer, ANativeWindowBuffer, handle));
+	}
+
+	static int __enqueue_buffer(struct preview_stream_ops* w,
+					  buffer_handle_t* buffer)
+	{
+		ANativeWindow *a = anw(w);
+		return a->queueBuffer(a,
+				  container_of(buffer, ANativeWindowBuffer, handle));
+	}
+
+	static int __cancel_buffer(struct preview_stream_ops* w,
+					  buffer_handle_t* buffer)
+	{
+		ANativeWindow *a = anw(w);
+		return a->cancelBuffer(a,
+				  container_of(buffer, ANativeWindowBuffer, handle));
+	}
+
+	static int __set_buffer_count(struct preview_stream_ops* w, int count)
+	{
+		ANativeWindow *a = anw(w);
+		return native_window_set_buffer_count(a, count);
+	}
+
+	static int __set_buffers_geometry(struct preview_stream_ops* w,
+					  int width, int height, int format)
+	{
+		ANativeWindow *a = anw(w);
+		return native_window_set_buffers_geometry(a,
+						  width, height, format);
+	}
+
+	static int __set_crop(struct preview_stream_ops *w,
+					  int left, int top, int right, int bottom)
+	{
+		ANativeWindow *a = anw(w);
+		android_native_rect_t crop;
+		crop.left = left;
+		crop.top = top;
+		crop.right = right;
+		crop.bottom = bottom;
+		return native_window_set_crop(a, &crop);
+	}
+
+	static int __set_usage(struct preview_stream_ops* w, int usage)
+	{
+		ANativeWindow *a = anw(w);
+		return native_window_set_usage(a, usage);
+	}
+
+	static int __set_swap_interval(struct preview_stream_ops *w, int interval)
+	{
+		ANativeWindow *a = anw(w);
+		return a->setSwapInterval(a, interval);
+	}
+
+	static int __get_min_undequeued_buffer_count(
+					  const struct preview_stream_ops *w,
+					  int *count)
+	{
+		ANativeWindow *a = anw(w);
+		return a->query(a, NATIVE_WINDOW_MIN_UNDEQUEUED_BUFFERS, count);
+	}
+
+#undef anw
+};
+
+};  // namespace android
+
+#endif
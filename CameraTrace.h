@@ -0,0 +1,121 @@
+#ifndef ANDROID_HARDWARE_CAMERA_TRACE_H
+#define ANDROID_HARDWARE_CAMERA_TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <utils/Timers.h>
+
+/**
+ * Compile-time trace levels for the camera HAL wrapper.  Build with
+ * -DCAMERA_TRACE_LEVEL=n to enable them:
+ *
+ *   CAMERA_TRACE_NONE   - no tracing; the macros expand to nothing.
+ *   CAMERA_TRACE_CALLS  - control calls and notifications.
+ *   CAMERA_TRACE_FRAMES - additionally every data callback.
+ *
+ * Enabled trace points do no I/O.  They append to an in-memory ring that
+ * keeps the last RING_SIZE records and is printed by CameraTrace::dump().
+ */
+#define CAMERA_TRACE_NONE       0
+#define CAMERA_TRACE_CALLS      1
+#define CAMERA_TRACE_FRAMES     2
+
+#ifndef CAMERA_TRACE_LEVEL
+#define CAMERA_TRACE_LEVEL      CAMERA_TRACE_NONE
+#endif
+
+#if CAMERA_TRACE_LEVEL >= CAMERA_TRACE_CALLS
+#define CAMERA_TRACE_CALL(name, arg1, arg2) \
+		android::CameraTrace::record(__FUNCTION__, (name), (arg1), (arg2))
+#else
+#define CAMERA_TRACE_CALL(name, arg1, arg2)     ((void)0)
+#endif
+
+#if CAMERA_TRACE_LEVEL >= CAMERA_TRACE_FRAMES
+#define CAMERA_TRACE_FRAME(name, arg1, arg2) \
+		android::CameraTrace::record(__FUNCTION__, (name), (arg1), (arg2))
+#else
+#define CAMERA_TRACE_FRAME(name, arg1, arg2)    ((void)0)
+#endif
+
+namespace android {
+
+class CameraTrace {
+public:
+	enum { RING_SIZE = 1024 };  // must be a power of two
+	enum { NAME_SIZE = 8 };
+
+	struct Entry {
+		// seq is written last; 0 or a stale value means the slot is being
+		// (re)written or was never used.
+		volatile int32_t seq;
+		pid_t tid;
+		nsecs_t time;
+		const char *func;       // always a string literal
+		char name[NAME_SIZE];
+		int32_t arg1;
+		int32_t arg2;
+	};
+
+	/** Append a record.  Lock-free; safe from any HAL thread. */
+	static void record(const char *func, const char *name,
+					   int32_t arg1, int32_t arg2)
+	{
+		Ring &r = ring();
+		int32_t seq = android_atomic_inc(&r.next);
+		Entry &e = r.entries[seq & (RING_SIZE - 1)];
+
+		e.seq = 0;
+		e.tid = gettid();
+		e.time = systemTime(SYSTEM_TIME_MONOTONIC);
+		e.func = func;
+		strncpy(e.name, name ? name : "", NAME_SIZE - 1);
+		e.name[NAME_SIZE - 1] = '\0';
+		e.arg1 = arg1;
+		e.arg2 = arg2;
+		android_memory_barrier();
+		e.seq = seq + 1;
+	}
+
+	/** Print the records still held in the ring, oldest first. */
+	static void dump(FILE *out)
+	{
+		Ring &r = ring();
+		int32_t next = r.next;
+		int32_t first = next > RING_SIZE ? next - RING_SIZE : 0;
+		nsecs_t base = 0;
+
+		fprintf(out, "camera trace: %d records, showing %d\n",
+				next, next - first);
+		for (int32_t seq = first; seq < next; seq++) {
+			const Entry &e = r.entries[seq & (RING_SIZE - 1)];
+			if (e.seq != seq + 1)
+				continue;   // overwritten or still being written
+			if (!base)
+				base = e.time;
+			fprintf(out, "%12.6f [%5d] %s(%s) %d %d\n",
+					(e.time - base) / 1e9, e.tid, e.func, e.name,
+					e.arg1, e.arg2);
+		}
+	}
+
+private:
+	struct Ring {
+		volatile int32_t next;
+		Entry entries[RING_SIZE];
+	};
+
+	// Plain-old-data, so the ring is zero-initialised without a static
+	// constructor and shared by every translation unit.
+	static Ring &ring()
+	{
+		static Ring sRing;
+		return sRing;
+	}
+};
+
+};  // namespace android
+
+#endif
@@ -56,10 +56,26 @@
 #undef CameraHardwareInterface
 
 #include "CameraNativeWindow.h"
+#include "gonk/CameraCapabilities.h"
 
 using namespace android;
 using namespace mozilla;
 
+// Builds for a single device can pin the camera backend with one of
+// -DGONK_CAMERA_BACKEND_ICS, -DGONK_CAMERA_BACKEND_SGS2 or
+// -DGONK_CAMERA_BACKEND_MAGURO.  The other backends and the runtime probing
+// are then compiled out, and GonkCameraInputStream calls the backend
+// directly rather than through CameraHardwareInterface's vtable.
+#if defined(GONK_CAMERA_BACKEND_ICS) + defined(GONK_CAMERA_BACKEND_SGS2) + \
+    defined(GONK_CAMERA_BACKEND_MAGURO) > 1
+#error "Pin at most one camera backend"
+#endif
+#if defined(GONK_CAMERA_BACKEND_ICS) || defined(GONK_CAMERA_BACKEND_SGS2) || \
+    defined(GONK_CAMERA_BACKEND_MAGURO)
+#define GONK_CAMERA_BACKEND_PINNED
+#endif
+
+#ifndef GONK_CAMERA_BACKEND_ICS
 // Intentionally not trying to dlclose() this handle.  That's playing
 // Russian roulette with security bugs.
 static void* sCameraLib;
@@ -79,8 +95,10 @@ GetCameraLibHandle()
   PR_CallOnce(&sInitCameraLib, InitCameraLib);
   return sCameraLib;
 }
+#endif
 
-class CameraHardwareInterface {
+// What every backend needs to know about the device.
+class GonkCameraBackend {
   public:
     enum Type {
       CAMERA_SGS2,
@@ -89,23 +107,65 @@ class CameraHardwareInterface {
       CAMERA_DEFAULT
     };
 
-    static Type getType() {
-      void* cameraLib = GetCameraLibHandle();
-      if (!cameraLib)
-        return CAMERA_ICS;
+    struct Profile {
+      Type type;
+      char board[PROPERTY_VALUE_MAX];   // ro.product.board
+    };
+
+    // Probed on first use and cached for the life of the process.
+    static const Profile& getProfile() {
+      PR_CallOnce(&sProfileOnce, InitProfile);
+      return sProfile;
+    }
 
-      char propValue[PROPERTY_VALUE_MAX];
-      property_get("ro.product.board", propValue, NULL);
-      if (!strcmp(propValue, "GT-I9100"))
-        return CAMERA_SGS2;
+#if defined(GONK_CAMERA_BACKEND_ICS)
+    static Type getType() { return CAMERA_ICS; }
+#elif defined(GONK_CAMERA_BACKEND_SGS2)
+    static Type getType() { return CAMERA_SGS2; }
+#elif defined(GONK_CAMERA_BACKEND_MAGURO)
+    static Type getType() { return CAMERA_MAGURO; }
+#else
+    static Type getType() { return getProfile().type; }
+#endif
+
+  private:
+    static PRStatus InitProfile();
+
+    static Profile sProfile;
+    static PRCallOnceType sProfileOnce;
+};
 
-      if (!strcmp(propValue, "msm7627a_sku1") || !strcmp(propValue, "MSM7627A_SKU3"))
-        return CAMERA_MAGURO;
+GonkCameraBackend::Profile GonkCameraBackend::sProfile;
+PRCallOnceType GonkCameraBackend::sProfileOnce;
 
-      printf_stderr("CameraHardwareInterface : unsupported camera for device %s\n", propValue);
-      return CAMERA_DEFAULT;
-    }
+PRStatus
+GonkCameraBackend::InitProfile()
+{
+  property_get("ro.product.board", sProfile.board, "");
+
+#ifdef GONK_CAMERA_BACKEND_PINNED
+  sProfile.type = getType();
+#else
+  if (!GetCameraLibHandle()) {
+    sProfile.type = CAMERA_ICS;
+  } else if (!strcmp(sProfile.board, "GT-I9100")) {
+    sProfile.type = CAMERA_SGS2;
+  } else if (!strcmp(sProfile.board, "msm7627a_sku1") || !strcmp(sProfile.board, "MSM7627A_SKU3")) {
+    sProfile.type = CAMERA_MAGURO;
+  } else {
+    printf_stderr("CameraHardwareInterface : unsupported camera for device %s\n", sProfile.board);
+    sProfile.type = CAMERA_DEFAULT;
+  }
+#endif
+  return PR_SUCCESS;
+}
 
+#ifdef GONK_CAMERA_BACKEND_PINNED
+// The pinned backend class becomes CameraHardwareInterface itself, below.
+#define GONK_CAMERA_BACKEND_BASE GonkCameraBackend
+#else
+class CameraHardwareInterface : public GonkCameraBackend {
+  public:
     static CameraHardwareInterface* openCamera(PRUint32 aCamera);
 
     virtual ~CameraHardwareInterface() { }
@@ -120,16 +180,26 @@ class CameraHardwareInterface {
                               void* user) = 0;
     virtual status_t startPreview() = 0;
     virtual void stopPreview() = 0;
+    virtual status_t startRecording() = 0;
+    virtual void stopRecording() = 0;
+    virtual void releaseRecordingFrame(const sp<IMemory>& mem) = 0;
+    virtual status_t storeMetaDataInBuffers(bool enable) = 0;
     virtual void release() = 0;
     virtual status_t setParameters(const CameraParameters& params) = 0;
     virtual CameraParameters getParameters() const = 0;
+    virtual status_t sendCommand(int32_t cmd, int32_t arg1, int32_t arg2) = 0;
+
+    virtual void setMetadataCallback(data_callback_ics data_cb) = 0;
 
   protected:
     CameraHardwareInterface(PRUint32 aCamera = 0) { };
 };
+#define GONK_CAMERA_BACKEND_BASE CameraHardwareInterface
+#endif
 
+#if !defined(GONK_CAMERA_BACKEND_PINNED) || defined(GONK_CAMERA_BACKEND_ICS)
 // ICS specific subclass, because we can't cast CameraHardwareInterface_ICS to sp<T> in general
-class CameraICS : public CameraHardwareInterface {
+class CameraICS : public GONK_CAMERA_BACKEND_BASE {
   public:
     CameraICS(PRUint32 aCamera = 0) : mOk(false), mCamera(nsnull), mModule(nsnull) {
       if (hw_get_module(CAMERA_HARDWARE_MODULE_ID,
@@ -182,6 +252,22 @@ class CameraICS : public CameraHardwareInterface {
       mWindow.clear();
     };
 
+    status_t startRecording() {
+      return mCamera->startRecording();
+    };
+
+    void stopRecording() {
+      mCamera->stopRecording();
+    };
+
+    void releaseRecordingFrame(const sp<IMemory>& mem) {
+      mCamera->releaseRecordingFrame(mem);
+    };
+
+    status_t storeMetaDataInBuffers(bool enable) {
+      return mCamera->storeMetaDataInBuffers(enable);
+    };
+
     void release() {
       return mCamera->release();
     };
@@ -194,14 +280,24 @@ class CameraICS : public CameraHardwareInterface {
       return mCamera->getParameters();
     };
 
+    status_t sendCommand(int32_t cmd, int32_t arg1, int32_t arg2) {
+      return mCamera->sendCommand(cmd, arg1, arg2);
+    };
+
+    void setMetadataCallback(data_callback_ics data_cb) {
+      mCamera->setMetadataCallback(data_cb);
+    };
+
   protected:
     bool mOk;
     sp<CameraHardwareInterface_ICS> mCamera;
     camera_module_t *mModule;
     sp<ANativeWindow> mWindow;
 };
+#endif
 
-template<class T> class CameraImpl : public CameraHardwareInterface {
+#ifndef GONK_CAMERA_BACKEND_ICS
+template<class T> class CameraImpl : public GONK_CAMERA_BACKEND_BASE {
   public:
     typedef sp<T> (*HAL_openCameraHardware_DEFAULT)(int);
     typedef sp<T> (*HAL_openCameraHardware_SGS2)(int);
@@ -274,6 +370,18 @@ template<class T> class CameraImpl : public CameraHardwareInterface {
       mCamera->stopPreview();
     };
 
+    status_t startRecording() {
+      return mCamera->startRecording();
+    };
+
+    void stopRecording() {
+      mCamera->stopRecording();
+    };
+
+    void releaseRecordingFrame(const sp<IMemory>& mem) {
+      mCamera->releaseRecordingFrame(mem);
+    };
+
     void release() {
       return mCamera->release();
     };
@@ -285,13 +393,48 @@ template<class T> class CameraImpl : public CameraHardwareInterface {
     CameraParameters getParameters() const {
       return mCamera->getParameters();
     };
+
+    status_t sendCommand(int32_t cmd, int32_t arg1, int32_t arg2) {
+      return mCamera->sendCommand(cmd, arg1, arg2);
+    };
+
+    // Pre-ICS HALs always store YUV data in the video buffers.
+    status_t storeMetaDataInBuffers(bool enable) {
+      return enable ? INVALID_OPERATION : OK;
+    };
+
+    // Only ICS HALs report frame metadata.
+    void setMetadataCallback(data_callback_ics data_cb) {
+    };
   protected:
     bool mOk;
     sp<T> mCamera;
 };
+#endif
+
+#ifdef GONK_CAMERA_BACKEND_PINNED
+#if defined(GONK_CAMERA_BACKEND_ICS)
+typedef CameraICS GonkPinnedCamera;
+#elif defined(GONK_CAMERA_BACKEND_SGS2)
+typedef CameraImpl<CameraHardwareInterface_SGS2> GonkPinnedCamera;
+#else
+typedef CameraImpl<CameraHardwareInterface_MAGURO> GonkPinnedCamera;
+#endif
+
+class CameraHardwareInterface : public GonkPinnedCamera {
+  public:
+    static CameraHardwareInterface* openCamera(PRUint32 aCamera);
+
+  private:
+    CameraHardwareInterface(PRUint32 aCamera) : GonkPinnedCamera(aCamera) { };
+};
+#endif
 
 CameraHardwareInterface* CameraHardwareInterface::openCamera(PRUint32 aCamera)  {
   nsAutoPtr<CameraHardwareInterface> instance;
+#ifdef GONK_CAMERA_BACKEND_PINNED
+  instance = new CameraHardwareInterface(aCamera);
+#else
   switch(getType()) {
     case CAMERA_SGS2:
       instance = new CameraImpl<CameraHardwareInterface_SGS2>(aCamera);
@@ -306,6 +449,7 @@ CameraHardwareInterface* CameraHardwareInterface::openCamera(PRUint32 aCamera)
       instance = new CameraICS(aCamera);
       break;
   }
+#endif
 
   if (!instance->ok()) {
     return nsnull;
@@ -321,9 +465,10 @@ NS_IMPL_THREADSAFE_ISUPPORTS2(GonkCameraInputStream, nsIInputStream, nsIAsyncInp
 
 GonkCameraInputStream::GonkCameraInputStream() :
   mAvailable(sizeof(nsRawVideoHeader)), mWidth(0), mHeight(0), mFps(30), mCamera(0),
-  mHeaderSent(false), mClosed(true), mClosing(false), mIs420p(false), mFrameSize(0), mMonitor("GonkCamera.Monitor")
+  mHeaderSent(false), mClosed(true), mClosing(false), mIs420p(false), mRecording(false),
+  mLastVideoFrameTime(0), mFrameSize(0), mMonitor("GonkCamera.Monitor")
 {
-
+  mFaces.clear();
 }
 
 GonkCameraInputStream::~GonkCameraInputStream() {
@@ -345,27 +490,83 @@ GonkCameraInputStream::DataCallback(int32_t aMsgType, const sp<IMemory>& aDataPt
   stream->ReceiveFrame((char*)aDataPtr->pointer(), aDataPtr->size());
 }
 
+void
+GonkCameraInputStream::MetadataCallback(int32_t aMsgType, const sp<IMemory>& aDataPtr,
+                                        camera_frame_metadata_t* aMetadata, void *aUser) {
+  GonkCameraInputStream* stream = (GonkCameraInputStream*)(aUser);
+  switch (aMsgType) {
+    case CAMERA_MSG_PREVIEW_METADATA:
+      stream->ReceiveFaces(aMetadata);
+      break;
+    case CAMERA_MSG_PREVIEW_FRAME:
+      stream->ReceiveFrame((char*)aDataPtr->pointer(), aDataPtr->size());
+      break;
+  }
+}
+
+void
+GonkCameraInputStream::DataCallbackTimestamp(nsecs_t aTimestamp, int32_t aMsgType,
+                                             const sp<IMemory>& aDataPtr, void *aUser) {
+  GonkCameraInputStream* stream = (GonkCameraInputStream*)(aUser);
+  if (aMsgType != CAMERA_MSG_VIDEO_FRAME)
+    return;
+
+  // Recording can run faster than the rate we were asked for; use the HAL
+  // timestamps to drop the excess rather than queueing frames only to
+  // throw them away in ReceiveFrame().  The 10% slack absorbs jitter.
+  nsecs_t interval = stream->mFps > 0 ? seconds_to_nanoseconds(1) / stream->mFps : 0;
+  if (!stream->mLastVideoFrameTime ||
+      aTimestamp - stream->mLastVideoFrameTime >= interval - interval / 10) {
+    stream->mLastVideoFrameTime = aTimestamp;
+    stream->ReceiveFrame((char*)aDataPtr->pointer(), aDataPtr->size());
+  }
+
+  // ReceiveFrame() copied the frame, so the HAL can have it back now.
+  // Once closing, stopRecording() reclaims whatever is still out, and
+  // mHardware may already be gone.
+  if (stream->mClosing)
+    return;
+  ReentrantMonitorAutoEnter enter(stream->mMonitor);
+  if (stream->mHardware)
+    stream->mHardware->releaseRecordingFrame(aDataPtr);
+}
+
+void
+GonkCameraInputStream::ReceiveFaces(camera_frame_metadata_t* aMetadata) {
+  if (mClosing)
+    return;
+  ReentrantMonitorAutoEnter enter(mMonitor);
+  mFaces.set(aMetadata, systemTime(SYSTEM_TIME_MONOTONIC));
+}
+
+void
+GonkCameraInputStream::GetFaces(CameraFrameFaces& aFaces) {
+  ReentrantMonitorAutoEnter enter(mMonitor);
+  aFaces.copyFrom(mFaces);
+}
+
 PRUint32
 GonkCameraInputStream::getNumberOfCameras() {
-  typedef int (*HAL_getNumberOfCamerasFunct)(void);
-  void* cameraLib = GetCameraLibHandle();
-  if (!cameraLib) {
-    // try the ICS way
-    camera_module_t* module;
-    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID,
-              (const hw_module_t **)&module) < 0) {
-      printf_stderr("getNumberOfCameras : Could not load camera HAL module");
+#ifndef GONK_CAMERA_BACKEND_ICS
+  if (CameraHardwareInterface::getType() != CameraHardwareInterface::CAMERA_ICS) {
+    typedef int (*HAL_getNumberOfCamerasFunct)(void);
+    void *hal = dlsym(GetCameraLibHandle(), "HAL_getNumberOfCameras");
+    if (nsnull == hal)
       return 0;
-    }
-    return module->get_number_of_cameras();
+
+    HAL_getNumberOfCamerasFunct funct = reinterpret_cast<HAL_getNumberOfCamerasFunct> (hal);
+    return funct();
   }
+#endif
 
-  void *hal = dlsym(cameraLib, "HAL_getNumberOfCameras");
-  if (nsnull == hal)
+  // the ICS way
+  camera_module_t* module;
+  if (hw_get_module(CAMERA_HARDWARE_MODULE_ID,
+            (const hw_module_t **)&module) < 0) {
+    printf_stderr("getNumberOfCameras : Could not load camera HAL module");
     return 0;
-
-  HAL_getNumberOfCamerasFunct funct = reinterpret_cast<HAL_getNumberOfCamerasFunct> (hal);
-  return funct();
+  }
+  return module->get_number_of_cameras();
 }
 
 NS_IMETHODIMP
@@ -387,38 +588,64 @@ GonkCameraInputStream::Init(nsACString& aContentType, nsCaptureParams* aParams)
   if (mCamera >= maxNumCameras)
     mCamera = 0;
 
+  // Capabilities saved by an earlier process are good until the HAL
+  // changes, which the fingerprint catches.
+  const char* board = CameraHardwareInterface::getProfile().board;
+  const hw_module_t* module = nsnull;
+  if (CameraHardwareInterface::getType() == CameraHardwareInterface::CAMERA_ICS)
+    hw_get_module(CAMERA_HARDWARE_MODULE_ID, &module);
+  String8 fingerprint = CameraCapabilities::fingerprint(module);
+  sp<CameraCapabilities> caps = CameraCapabilities::lookup(mCamera);
+  if (!caps.get())
+    caps = CameraCapabilities::load(board, mCamera, fingerprint.string());
+
   mHardware = CameraHardwareInterface::openCamera(mCamera);
 
   if (!mHardware)
     return NS_ERROR_FAILURE;
 
-  mHardware->setCallbacks(NULL, GonkCameraInputStream::DataCallback, NULL, this);
-
-  mHardware->enableMsgType(android::CAMERA_MSG_PREVIEW_FRAME);
+  mHardware->setCallbacks(NULL, GonkCameraInputStream::DataCallback,
+                          GonkCameraInputStream::DataCallbackTimestamp, this);
+  mHardware->setMetadataCallback(GonkCameraInputStream::MetadataCallback);
 
   CameraParameters params = mHardware->getParameters();
 
   printf_stderr("Preview format : %s\n", params.get(params.KEY_SUPPORTED_PREVIEW_FORMATS));
 
-  Vector<Size> previewSizes;
-  params.getSupportedPreviewSizes(previewSizes);
-
-  // find the available preview size closest to the requested size.
-  PRUint32 minSizeDelta = PR_UINT32_MAX;
-  PRUint32 bestWidth = mWidth;
-  PRUint32 bestHeight = mHeight;
-  for (PRUint32 i = 0; i < previewSizes.size(); i++) {
-    Size size = previewSizes[i];
-    PRUint32 delta = abs(size.width * size.height - mWidth * mHeight);
-    if (delta < minSizeDelta) {
-      minSizeDelta = delta;
-      bestWidth = size.width;
-      bestHeight = size.height;
+  // the supported sizes only need parsing the first time a camera is opened
+  if (!caps.get()) {
+    caps = CameraCapabilities::build(mCamera, params.flatten().string());
+    caps->save(board, mCamera, fingerprint.string());
+  }
+
+  // find the available preview size closest to the requested size, and
+  // record instead if a video size is closer still.  Video frames must
+  // hold YUV data for us to convert them.
+  PRUint32 previewDelta, videoDelta;
+  ssize_t preview = CameraCapabilities::closestSize(caps->previewSizes(), mWidth, mHeight, &previewDelta);
+  ssize_t video = CameraCapabilities::closestSize(caps->videoSizes(), mWidth, mHeight, &videoDelta);
+  mRecording = video >= 0 && videoDelta < previewDelta &&
+               mHardware->storeMetaDataInBuffers(false) == OK;
+
+  if (mRecording) {
+    mWidth = caps->videoSizes()[video].width;
+    mHeight = caps->videoSizes()[video].height;
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", mWidth, mHeight);
+    params.set("video-size", size);
+    // the preview must not be larger than the video; use the HAL's choice
+    const char* preferred = params.get("preferred-preview-size-for-video");
+    if (preferred)
+      params.set(params.KEY_PREVIEW_SIZE, preferred);
+    mHardware->enableMsgType(android::CAMERA_MSG_VIDEO_FRAME);
+  } else {
+    if (preview >= 0) {
+      mWidth = caps->previewSizes()[preview].width;
+      mHeight = caps->previewSizes()[preview].height;
     }
+    params.setPreviewSize(mWidth, mHeight);
+    mHardware->enableMsgType(android::CAMERA_MSG_PREVIEW_FRAME);
   }
-  mWidth = bestWidth;
-  mHeight = bestHeight;
-  params.setPreviewSize(mWidth, mHeight);
 
   // try to set preferred image format
   params.setPreviewFormat("yuv420p");
@@ -428,10 +655,29 @@ GonkCameraInputStream::Init(nsACString& aContentType, nsCaptureParams* aParams)
   params = mHardware->getParameters();
   mFps = params.getPreviewFrameRate();
 
-  mIs420p = !strcmp(params.getPreviewFormat(), "yuv420p");
+  const char* format = params.getPreviewFormat();
+  if (mRecording && params.get(params.KEY_VIDEO_FRAME_FORMAT))
+    format = params.get(params.KEY_VIDEO_FRAME_FORMAT);
+  mIs420p = !strcmp(format, "yuv420p");
 
   mHardware->startPreview();
 
+  if (mRecording && mHardware->startRecording() != OK) {
+    printf_stderr("GonkCameraInputStream: startRecording() failed\n");
+    mHardware->disableMsgType(android::CAMERA_MSG_ALL_MSGS);
+    mHardware->stopPreview();
+    mHardware->release();
+    delete mHardware;
+    mHardware = nsnull;
+    return NS_ERROR_FAILURE;
+  }
+
+  // Face detection can only be started once preview is running.
+  if (caps->maxDetectedFacesHw() > 0) {
+    mHardware->enableMsgType(CAMERA_MSG_PREVIEW_METADATA);
+    mHardware->sendCommand(CAMERA_CMD_START_FACE_DETECTION, CAMERA_FACE_DETECTION_HW, 0);
+  }
+
   mClosed = false;
   return NS_OK;
 }
@@ -586,9 +832,12 @@ void GonkCameraInputStream::doClose() {
   if (mClosed)
     return;
   mHardware->disableMsgType(android::CAMERA_MSG_ALL_MSGS);
+  if (mRecording)
+    mHardware->stopRecording();
   mHardware->stopPreview();
   mHardware->release();
   delete mHardware;
+  mHardware = nsnull;
   mClosed = true;
 }
 
@@ -16,6 +16,7 @@
 #include "mozilla/ReentrantMonitor.h"
 
 #include "binder/IMemory.h"
+#include "gonk/CameraFrameFaces.h"
 
 using namespace android;
 
@@ -46,9 +47,18 @@ class GonkCameraInputStream : public nsIAsyncInputStream {
     void ReceiveFrame(char* frame, PRUint32 length);
 
     static void  DataCallback(int32_t aMsgType, const sp<IMemory>& aDataPtr, void *aUser);
+    static void  MetadataCallback(int32_t aMsgType, const sp<IMemory>& aDataPtr,
+                                  camera_frame_metadata_t* aMetadata, void *aUser);
+    static void  DataCallbackTimestamp(nsecs_t aTimestamp, int32_t aMsgType,
+                                       const sp<IMemory>& aDataPtr, void *aUser);
     static PRUint32 getNumberOfCameras();
 
+    // Copies the most recent face-detection result; numFaces is 0 if the
+    // camera doesn't do face detection.
+    void GetFaces(CameraFrameFaces& aFaces);
+
   protected:
+    void ReceiveFaces(camera_frame_metadata_t* aMetadata);
     void NotifyListeners();
     void doClose();
 
@@ -63,8 +73,11 @@ class GonkCameraInputStream : public nsIAsyncInputStream {
     bool mClosing;  // when this is true, don't try to enter mMonitor!
     bool mClosed;
     bool mIs420p;
+    bool mRecording;  // frames come from CAMERA_MSG_VIDEO_FRAME, not preview
+    nsecs_t mLastVideoFrameTime;  // HAL timestamp of the last frame queued
     nsDeque mFrameQueue;
     PRUint32 mFrameSize;
+    CameraFrameFaces mFaces;
     mozilla::ReentrantMonitor mMonitor;
     nsCOMPtr<nsIInputStreamCallback> mCallback;
     nsCOMPtr<nsIEventTarget> mCallbackTarget;
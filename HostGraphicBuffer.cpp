@@ -0,0 +1,133 @@
+#include "HostGraphicBuffer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <cutils/atomic.h>
+#include <cutils/native_handle.h>
+#include <system/graphics.h>
+
+#define HGB_LOGE( ... ) { (void)fprintf( stderr, __VA_ARGS__ ); }
+
+using namespace android;
+
+static int createMemfd(const char* name)
+{
+#ifdef __NR_memfd_create
+    return syscall(__NR_memfd_create, name, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+GraphicBuffer::GraphicBuffer(uint32_t w, uint32_t h, int f, uint32_t reqUsage)
+    : mInitCheck(NO_INIT),
+      mNativeHandle(0),
+      mBase(MAP_FAILED),
+      mSize(0),
+      mLockCount(0)
+{
+    width  = w;
+    height = h;
+    stride = (w + 15) & ~15;
+    format = f;
+    usage  = reqUsage;
+    handle = 0;
+
+    if (!w || !h) {
+        HGB_LOGE("GraphicBuffer: invalid dimensions %ux%u\n", w, h);
+        mInitCheck = BAD_VALUE;
+        return;
+    }
+
+    const size_t page = getpagesize();
+    mSize = (stride * h * bitsPerPixel(f) / 8 + page - 1) & ~(page - 1);
+
+    int fd = createMemfd("cnw-buffer");
+    if (fd < 0) {
+        HGB_LOGE("GraphicBuffer: memfd_create failed: %s\n", strerror(errno));
+        mInitCheck = -errno;
+        return;
+    }
+    if (ftruncate(fd, mSize) < 0) {
+        HGB_LOGE("GraphicBuffer: ftruncate(%zu) failed: %s\n", mSize, strerror(errno));
+        mInitCheck = -errno;
+        close(fd);
+        return;
+    }
+    mBase = mmap(0, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mBase == MAP_FAILED) {
+        HGB_LOGE("GraphicBuffer: mmap(%zu) failed: %s\n", mSize, strerror(errno));
+        mInitCheck = -errno;
+        close(fd);
+        return;
+    }
+
+    mNativeHandle = native_handle_create(1, 0);
+    mNativeHandle->data[0] = fd;
+    handle = mNativeHandle;
+    mInitCheck = NO_ERROR;
+}
+
+GraphicBuffer::~GraphicBuffer()
+{
+    if (mBase != MAP_FAILED) {
+        munmap(mBase, mSize);
+    }
+    if (mNativeHandle) {
+        native_handle_close(mNativeHandle);
+        native_handle_delete(mNativeHandle);
+    }
+}
+
+status_t GraphicBuffer::lock(uint32_t reqUsage, void** vaddr)
+{
+    if (mInitCheck != NO_ERROR) {
+        return mInitCheck;
+    }
+    android_atomic_inc(&mLockCount);
+    *vaddr = mBase;
+    return NO_ERROR;
+}
+
+status_t GraphicBuffer::unlock()
+{
+    if (android_atomic_dec(&mLockCount) <= 0) {
+        HGB_LOGE("GraphicBuffer: unlock of unlocked buffer %p\n", this);
+        android_atomic_inc(&mLockCount);
+        return INVALID_OPERATION;
+    }
+    return NO_ERROR;
+}
+
+ANativeWindowBuffer* GraphicBuffer::getNativeBuffer() const
+{
+    return static_cast<ANativeWindowBuffer*>(
+            const_cast<GraphicBuffer*>(this));
+}
+
+size_t GraphicBuffer::bitsPerPixel(int format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return 32;
+    case HAL_PIXEL_FORMAT_RGB_888:
+        return 24;
+    case HAL_PIXEL_FORMAT_RGB_565:
+    case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+    case HAL_PIXEL_FORMAT_YCbCr_422_I:
+        return 16;
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+    case HAL_PIXEL_FORMAT_YV12:
+        return 12;
+    default:
+        return 32;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef __HOST_GRAPHIC_BUFFER_H
+#define __HOST_GRAPHIC_BUFFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ui/egl/android_natives.h>
+#include <hardware/gralloc.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+
+namespace android {
+
+// GraphicBuffer stand-in used when CameraNativeWindow is built for the host
+// (CNW_HOST_BUFFERS). It implements the part of ui/GraphicBuffer.h that the
+// window relies on, backed by a memfd mapping instead of gralloc, so the
+// buffer queue logic can be run and profiled on plain Linux.
+class GraphicBuffer
+    : public EGLNativeBase<ANativeWindowBuffer, GraphicBuffer,
+                           LightRefBase<GraphicBuffer> >
+{
+public:
+    enum {
+        USAGE_SW_READ_OFTEN  = GRALLOC_USAGE_SW_READ_OFTEN,
+        USAGE_SW_WRITE_OFTEN = GRALLOC_USAGE_SW_WRITE_OFTEN,
+    };
+
+    GraphicBuffer(uint32_t w, uint32_t h, int format, uint32_t usage);
+    ~GraphicBuffer();
+
+    status_t initCheck() const { return mInitCheck; }
+
+    uint32_t getWidth() const  { return width; }
+    uint32_t getHeight() const { return height; }
+    uint32_t getStride() const { return stride; }
+    uint32_t getUsage() const  { return usage; }
+    int getPixelFormat() const { return format; }
+
+    // getSize returns the size in bytes of the mapping.
+    size_t getSize() const { return mSize; }
+
+    // lock returns the CPU address of the buffer. The mapping is permanent,
+    // so lock/unlock only check the calls are balanced.
+    status_t lock(uint32_t usage, void** vaddr);
+    status_t unlock();
+
+    ANativeWindowBuffer* getNativeBuffer() const;
+
+private:
+    // bitsPerPixel returns the storage size of one pixel in format.
+    static size_t bitsPerPixel(int format);
+
+    status_t mInitCheck;
+    native_handle_t* mNativeHandle;
+    void* mBase;
+    size_t mSize;
+    int32_t mLockCount;
+};
+
+}; // namespace android
+
+#endif // __HOST_GRAPHIC_BUFFER_H
@@ -0,0 +1,368 @@
+#include "ImageWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+
+using namespace android;
+
+// Files written but not yet fsync'ed are kept open until the next sync();
+// past this many, they are synced early rather than running out of fds.
+static const size_t MAX_UNSYNCED = 64;
+
+static off_t alignUp(off_t offset)
+{
+    return (offset + ImageWriter::ALIGNMENT - 1) & ~(off_t)(ImageWriter::ALIGNMENT - 1);
+}
+
+// Moves size bytes at offset in the heap file in to the current position of
+// out inside the kernel, with copy_file_range() or else splice() through a
+// pipe. Neither works on every heap (ashmem supports neither, for one), so
+// this returns how many bytes it managed, possibly 0.
+static size_t kernelCopy(int in, off_t offset, int out, size_t size)
+{
+    size_t done = 0;
+
+#ifdef __NR_copy_file_range
+    while (done < size) {
+        loff_t from = offset + done;
+        long n = syscall(__NR_copy_file_range, in, &from, out, NULL, size - done, 0);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    if (done == size) {
+        return done;
+    }
+#endif
+
+#ifdef __NR_splice
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        return done;
+    }
+    while (done < size) {
+        loff_t from = offset + done;
+        long n = syscall(__NR_splice, in, &from, pipefd[1], NULL, size - done, 0);
+        if (n <= 0) {
+            break;
+        }
+        // Whatever went into the pipe has to come out, or the file is short.
+        long moved = 0;
+        while (moved < n) {
+            long m = syscall(__NR_splice, pipefd[0], NULL, out, NULL, n - moved, 0);
+            if (m <= 0) {
+                break;
+            }
+            moved += m;
+        }
+        done += moved;
+        if (moved < n) {
+            break;
+        }
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+#endif
+
+    return done;
+}
+
+
+ImageWriter::ImageWriter(Layout layout, const char* path, size_t maxQueued)
+    : mLayout(layout),
+      mPath(path),
+      mMaxQueued(maxQueued ? maxQueued : 1),
+      mSyncsQueued(0),
+      mSyncsDone(0),
+      mSyncFailures(0),
+      mQuit(false),
+      mContainerFd(-1),
+      mContainerEnd(0),
+      mFailures(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+ImageWriter::~ImageWriter()
+{
+    if (mContainerFd >= 0) {
+        close(mContainerFd);
+    }
+    for (size_t i = 0; i < mUnsynced.size(); i++) {
+        close(mUnsynced[i]);
+    }
+}
+
+status_t ImageWriter::start()
+{
+    if (mLayout == CONTAINER) {
+        mContainerFd = open(mPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mContainerFd < 0) {
+            LOGE("Cannot create %s: %s", mPath.string(), strerror(errno));
+            return -errno;
+        }
+    }
+    return run("ImageWriter");
+}
+
+status_t ImageWriter::queue(const sp<IMemory>& image, nsecs_t timestamp,
+        const char* path)
+{
+    Mutex::Autolock lock(mMutex);
+    while (mQueue.size() >= mMaxQueued && !mQuit) {
+        mCondition.wait(mMutex);
+    }
+    if (mQuit) {
+        return INVALID_OPERATION;
+    }
+
+    Request request;
+    request.image = image;
+    request.timestamp = timestamp;
+    request.path.setTo(path ? path : mPath.string());
+    request.sync = 0;
+    mQueue.push(request);
+
+    mStats.queueDepth = mQueue.size();
+    if (mStats.queueDepth > mStats.maxQueueDepth) {
+        mStats.maxQueueDepth = mStats.queueDepth;
+    }
+    mCondition.broadcast();
+    return NO_ERROR;
+}
+
+int ImageWriter::sync()
+{
+    Mutex::Autolock lock(mMutex);
+    if (mQuit) {
+        return 0;
+    }
+
+    // Sync markers go through the queue, so that everything queued before
+    // one is written by the time it is reached.
+    Request request;
+    request.timestamp = 0;
+    request.sync = ++mSyncsQueued;
+    mQueue.push(request);
+    mCondition.broadcast();
+
+    while (mSyncsDone < request.sync) {
+        mCondition.wait(mMutex);
+    }
+    return mSyncFailures;
+}
+
+void ImageWriter::quit()
+{
+    {
+        Mutex::Autolock lock(mMutex);
+        mQuit = true;
+        mCondition.broadcast();
+    }
+    // join() rather than requestExitAndWait(), which would stop the thread
+    // after the request in hand; threadLoop() returns false once drained.
+    join();
+    syncPending();
+}
+
+void ImageWriter::getStats(Stats* stats) const
+{
+    Mutex::Autolock lock(mMutex);
+    *stats = mStats;
+}
+
+bool ImageWriter::threadLoop()
+{
+    Request request;
+    {
+        Mutex::Autolock lock(mMutex);
+        // Drain the queue before honouring quit().
+        while (mQueue.isEmpty() && !mQuit) {
+            mCondition.wait(mMutex);
+        }
+        if (mQueue.isEmpty()) {
+            return false;
+        }
+        request = mQueue[0];
+    }
+
+    if (request.sync) {
+        nsecs_t start = systemTime();
+        int failures = syncPending();
+
+        Mutex::Autolock lock(mMutex);
+        mQueue.removeAt(0);
+        mStats.queueDepth = mQueue.size();
+        mStats.syncTime += systemTime() - start;
+        mStats.syncs++;
+        mSyncFailures = failures;
+        mSyncsDone = request.sync;
+        mCondition.broadcast();
+        return true;
+    }
+
+    nsecs_t start = systemTime();
+    bool kernel = false;
+    bool ok = write(request, &kernel);
+    nsecs_t elapsed = systemTime() - start;
+    if (!ok) {
+        mFailures++;
+    }
+    size_t size = request.image->size();
+    // The HAL may reuse the buffer once the last reference is gone, which
+    // the queue still holds until the removeAt below.
+    request.image.clear();
+
+    Mutex::Autolock lock(mMutex);
+    mQueue.removeAt(0);
+    mStats.queueDepth = mQueue.size();
+    mStats.images++;
+    mStats.failures += !ok;
+    mStats.kernelCopies += kernel;
+    mStats.bytes += ok ? size : 0;
+    mStats.writeTime += elapsed;
+    mCondition.broadcast();
+    return true;
+}
+
+bool ImageWriter::write(const Request& request, bool* kernel)
+{
+    bool ok = mLayout == CONTAINER ? writeContainer(request, kernel)
+                                   : writeFile(request, kernel);
+    if (!ok) {
+        LOGE("Writing %s failed: %s", request.path.string(), strerror(errno));
+    }
+    return ok;
+}
+
+bool ImageWriter::writeFile(const Request& request, bool* kernel)
+{
+    int fd = open(request.path.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = request.image->size();
+    preallocate(fd, 0, size);
+    if (!writeMemory(fd, 0, request.image, kernel)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    mUnsynced.push(fd);
+    if (mUnsynced.size() >= MAX_UNSYNCED) {
+        mFailures += syncPending();
+    }
+    return true;
+}
+
+bool ImageWriter::writeContainer(const Request& request, bool* kernel)
+{
+    if (mContainerFd < 0) {
+        errno = EBADF;
+        return false;
+    }
+
+    ContainerRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = CONTAINER_MAGIC;
+    record.index = mStats.images;
+    record.size = request.image->size();
+    record.timestamp = request.timestamp;
+
+    off_t offset = mContainerEnd;
+    off_t end = alignUp(offset + sizeof(record) + record.size);
+    preallocate(mContainerFd, offset, end - offset);
+    if (pwrite(mContainerFd, &record, sizeof(record), offset) != (ssize_t)sizeof(record) ||
+            !writeMemory(mContainerFd, offset + sizeof(record), request.image, kernel)) {
+        return false;
+    }
+    mContainerEnd = end;
+    return true;
+}
+
+// syncPending fsyncs, and closes, every file written since the last call,
+// and returns the number of failed writes and syncs since then.
+int ImageWriter::syncPending()
+{
+    for (size_t i = 0; i < mUnsynced.size(); i++) {
+        if (fsync(mUnsynced[i]) != 0) {
+            LOGE("fsync failed: %s", strerror(errno));
+            mFailures++;
+        }
+        if (close(mUnsynced[i]) != 0) {
+            mFailures++;
+        }
+    }
+    mUnsynced.clear();
+    if (mContainerFd >= 0 && fsync(mContainerFd) != 0) {
+        LOGE("fsync of %s failed: %s", mPath.string(), strerror(errno));
+        mFailures++;
+    }
+
+    int failures = mFailures;
+    mFailures = 0;
+    return failures;
+}
+
+// preallocate reserves length bytes at offset, so that the file is laid out
+// in one piece rather than grown a write at a time. Filesystems without
+// fallocate just skip it.
+void ImageWriter::preallocate(int fd, off_t offset, size_t length)
+{
+#ifdef __NR_fallocate
+    uint64_t off = offset;
+    uint64_t len = length;
+#if defined(__LP64__)
+    syscall(__NR_fallocate, fd, 0, off, len);
+#else
+    // A 32-bit syscall() takes each 64-bit argument as two words, low first.
+    syscall(__NR_fallocate, fd, 0, (uint32_t)off, (uint32_t)(off >> 32),
+            (uint32_t)len, (uint32_t)(len >> 32));
+#endif
+#endif
+}
+
+// writeMemory writes all of mem at offset in fd without a copy in user
+// space: through the kernel when the heap's fd allows it, else straight
+// from the heap's mapping, in chunks that end on CHUNK_SIZE boundaries of
+// the file. It returns false on a write error, with errno set.
+bool ImageWriter::writeMemory(int fd, off_t offset, const sp<IMemory>& mem,
+        bool* kernel)
+{
+    ssize_t heapOffset;
+    size_t size;
+    sp<IMemoryHeap> heap = mem->getMemory(&heapOffset, &size);
+    const char* base = static_cast<const char*>(mem->pointer());
+
+    size_t done = 0;
+    if (heap != NULL && heap->getHeapID() >= 0 &&
+            lseek(fd, offset, SEEK_SET) == offset) {
+        done = kernelCopy(heap->getHeapID(), heap->getOffset() + heapOffset, fd, size);
+    }
+    *kernel = done > 0;
+
+    while (done < size) {
+        off_t at = offset + done;
+        size_t n = CHUNK_SIZE - at % CHUNK_SIZE;
+        if (n > size - done) {
+            n = size - done;
+        }
+        ssize_t written = pwrite(fd, base + done, n, at);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += written;
+    }
+    return true;
+}
@@ -0,0 +1,134 @@
+#ifndef __IMAGE_WRITER_H
+#define __IMAGE_WRITER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <binder/IMemory.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+namespace android {
+
+// ImageWriter saves captured images on a thread of its own, so that the
+// thread handling camera callbacks never blocks on the filesystem.
+//
+// Images are queued as the HAL's own IMemory, which the writer holds until
+// the image is on disk; the queue is bounded, and queue() blocks when it is
+// full rather than letting a burst pin every HAL buffer. Each image's space
+// is preallocated before it is written, writes are issued in large chunks
+// at aligned file offsets, and nothing is fsync'ed until sync(), which a
+// caller issues once per burst.
+class ImageWriter : public Thread
+{
+public:
+    enum Layout {
+        // One file per image, named by queue().
+        FILE_PER_IMAGE,
+        // Every image appended to the single file given to the constructor,
+        // each as a ContainerRecord followed by the image and padded to
+        // ALIGNMENT.
+        CONTAINER
+    };
+
+    enum {
+        ALIGNMENT = 4096,
+        CHUNK_SIZE = 1024 * 1024,
+        CONTAINER_MAGIC = 0x57474d49     // "IMGW"
+    };
+
+    struct ContainerRecord {
+        uint32_t magic;
+        uint32_t index;
+        uint32_t size;      // of the image that follows
+        uint32_t reserved;
+        int64_t timestamp;  // as given to queue()
+    };
+
+    struct Stats {
+        uint32_t images;
+        uint32_t failures;
+        // kernelCopies is how many images were moved from the heap's fd
+        // to the file inside the kernel.
+        uint32_t kernelCopies;
+        uint64_t bytes;
+        // writeTime is spent writing, and syncTime in fsync.
+        nsecs_t writeTime;
+        nsecs_t syncTime;
+        uint32_t syncs;
+        uint32_t queueDepth;
+        uint32_t maxQueueDepth;
+    };
+
+    // path is the container file for CONTAINER; for FILE_PER_IMAGE it is
+    // only used when queue() is not given one.
+    ImageWriter(Layout layout, const char* path, size_t maxQueued = 4);
+    virtual ~ImageWriter();
+
+    // start opens the container, if any, and starts the thread.
+    status_t start();
+
+    // queue hands image over for writing, waiting for room if the queue is
+    // full. It fails with INVALID_OPERATION once quit() has been called.
+    status_t queue(const sp<IMemory>& image, nsecs_t timestamp,
+            const char* path = 0);
+
+    // sync waits for everything queued so far to be written and fsync'ed,
+    // and returns the number of images that failed since the last sync.
+    int sync();
+
+    // quit writes whatever is still queued and stops the thread.
+    void quit();
+
+    void getStats(Stats* stats) const;
+
+private:
+    struct Request {
+        sp<IMemory> image;
+        nsecs_t timestamp;
+        String8 path;
+        // sync is nonzero for a sync marker, which carries no image.
+        uint32_t sync;
+    };
+
+    virtual bool threadLoop();
+
+    bool write(const Request& request, bool* kernel);
+    bool writeContainer(const Request& request, bool* kernel);
+    bool writeFile(const Request& request, bool* kernel);
+    int syncPending();
+
+    static void preallocate(int fd, off_t offset, size_t length);
+    static bool writeMemory(int fd, off_t offset, const sp<IMemory>& mem,
+            bool* kernel);
+
+    const Layout mLayout;
+    const String8 mPath;
+    const size_t mMaxQueued;
+
+    // mMutex guards everything below; mCondition is signalled whenever a
+    // request is queued or written.
+    mutable Mutex mMutex;
+    Condition mCondition;
+    Vector<Request> mQueue;
+    uint32_t mSyncsQueued;
+    uint32_t mSyncsDone;
+    int mSyncFailures;
+    bool mQuit;
+    Stats mStats;
+
+    // Only touched from the writer thread once it is running: the
+    // container, its end, and files written but not yet fsync'ed.
+    int mContainerFd;
+    off_t mContainerEnd;
+    Vector<int> mUnsynced;
+    int mFailures;
+};
+
+}; // namespace android
+
+#endif // __IMAGE_WRITER_H
@@ -0,0 +1,269 @@
+#include "RawCompressor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+#include <zlib.h>
+
+using namespace android;
+
+// Job is one raw image on its way to disk: the image itself, and the
+// compressed form of each chunk as workers finish them.
+class RawCompressor::Job : public LightRefBase<RawCompressor::Job>
+{
+public:
+    Job(const sp<IMemory>& raw, const char* path)
+        : raw(raw), path(path), size(raw->size()),
+          chunks((size + CHUNK_SIZE - 1) / CHUNK_SIZE), remaining(chunks),
+          start(systemTime())
+    {
+        outputs = new uint8_t*[chunks ? chunks : 1];
+        sizes = new uint32_t[chunks ? chunks : 1];
+        memset(outputs, 0, sizeof(outputs[0]) * chunks);
+    }
+
+    ~Job()
+    {
+        for (size_t i = 0; i < chunks; i++) {
+            free(outputs[i]);
+        }
+        delete[] outputs;
+        delete[] sizes;
+    }
+
+    const uint8_t* input(size_t chunk) const {
+        return static_cast<const uint8_t*>(raw->pointer()) + chunk * CHUNK_SIZE;
+    }
+
+    sp<IMemory> raw;
+    String8 path;
+    size_t size;
+    size_t chunks;
+    // remaining is guarded by the compressor's mMutex. Each worker only
+    // touches its own chunk's outputs and sizes entries.
+    size_t remaining;
+    nsecs_t start;
+    // outputs[i] is NULL for a chunk stored as is.
+    uint8_t** outputs;
+    uint32_t* sizes;
+};
+
+class RawCompressor::Worker : public Thread
+{
+public:
+    Worker(RawCompressor* owner) : mOwner(owner) { }
+
+private:
+    virtual bool threadLoop() { return mOwner->runTask(); }
+
+    RawCompressor* mOwner;
+};
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static int onlineCpus()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+}
+
+
+RawCompressor::RawCompressor(int threads, int level)
+    : mThreads(threads > 0 ? threads : onlineCpus()),
+      mLevel(level),
+      mPendingJobs(0),
+      mFailures(0),
+      mQuit(false)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+RawCompressor::~RawCompressor()
+{
+    {
+        Mutex::Autolock lock(mMutex);
+        mQuit = true;
+        mCondition.broadcast();
+    }
+    // Workers finish the queued chunks before they exit: runTask() only
+    // returns false once mTasks is empty, so join() rather than
+    // requestExitAndWait(), which would stop each after its current chunk.
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+    }
+}
+
+status_t RawCompressor::start()
+{
+    for (int i = 0; i < mThreads; i++) {
+        sp<Worker> worker = new Worker(this);
+        status_t s = worker->run("RawCompressor");
+        if (s != NO_ERROR) {
+            return s;
+        }
+        mWorkers.push(worker);
+    }
+    return NO_ERROR;
+}
+
+void RawCompressor::compress(const sp<IMemory>& raw, const char* path)
+{
+    sp<Job> job = new Job(raw, path);
+
+    Mutex::Autolock lock(mMutex);
+    mPendingJobs++;
+    if (job->chunks == 0 || mWorkers.isEmpty()) {
+        // Nothing to spread over the pool; write it here.
+        bool ok = writeJob(job.get());
+        mPendingJobs--;
+        mFailures += !ok;
+        mStats.images++;
+        mStats.failures += !ok;
+        return;
+    }
+    for (size_t i = 0; i < job->chunks; i++) {
+        Task task;
+        task.job = job;
+        task.chunk = i;
+        mTasks.push(task);
+    }
+    mCondition.broadcast();
+}
+
+int RawCompressor::wait()
+{
+    Mutex::Autolock lock(mMutex);
+    while (mPendingJobs > 0) {
+        mCondition.wait(mMutex);
+    }
+    int failures = mFailures;
+    mFailures = 0;
+    return failures;
+}
+
+void RawCompressor::getStats(Stats* stats) const
+{
+    Mutex::Autolock lock(mMutex);
+    *stats = mStats;
+}
+
+bool RawCompressor::runTask()
+{
+    Task task;
+    {
+        Mutex::Autolock lock(mMutex);
+        while (mTasks.isEmpty() && !mQuit) {
+            mCondition.wait(mMutex);
+        }
+        if (mTasks.isEmpty()) {
+            return false;
+        }
+        task = mTasks[0];
+        mTasks.removeAt(0);
+    }
+
+    nsecs_t start = systemTime();
+    Job* job = task.job.get();
+    compressChunk(job, task.chunk);
+
+    bool last;
+    {
+        Mutex::Autolock lock(mMutex);
+        mStats.busyTime += systemTime() - start;
+        last = --job->remaining == 0;
+    }
+    if (!last) {
+        return true;
+    }
+
+    // Every chunk is in; whoever did the last one writes the file.
+    start = systemTime();
+    bool ok = writeJob(job);
+    nsecs_t now = systemTime();
+
+    Mutex::Autolock lock(mMutex);
+    mStats.busyTime += now - start;
+    mStats.wallTime += now - job->start;
+    mStats.images++;
+    mStats.failures += !ok;
+    mStats.rawBytes += ok ? job->size : 0;
+    for (size_t i = 0; ok && i < job->chunks; i++) {
+        mStats.storedBytes += job->sizes[i] & ~CHUNK_STORED;
+    }
+    mFailures += !ok;
+    mPendingJobs--;
+    mCondition.broadcast();
+    return true;
+}
+
+void RawCompressor::compressChunk(Job* job, size_t chunk)
+{
+    size_t length = job->size - chunk * CHUNK_SIZE;
+    if (length > CHUNK_SIZE) {
+        length = CHUNK_SIZE;
+    }
+    const uint8_t* input = job->input(chunk);
+
+    uLongf size = compressBound(length);
+    uint8_t* output = static_cast<uint8_t*>(malloc(size));
+    if (output && compress2(output, &size, input, length, mLevel) == Z_OK &&
+            size < length) {
+        job->outputs[chunk] = output;
+        job->sizes[chunk] = size;
+        return;
+    }
+    // Incompressible, or out of memory: keep the chunk as it is.
+    free(output);
+    job->outputs[chunk] = 0;
+    job->sizes[chunk] = length | CHUNK_STORED;
+}
+
+bool RawCompressor::writeJob(Job* job)
+{
+    int fd = open(job->path.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOGE("Cannot create %s: %s", job->path.string(), strerror(errno));
+        return false;
+    }
+
+    RawFileHeader header;
+    header.magic = RAW_MAGIC;
+    header.version = RAW_VERSION;
+    header.chunkSize = CHUNK_SIZE;
+    header.chunks = job->chunks;
+    header.size = job->size;
+
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, job->sizes, sizeof(job->sizes[0]) * job->chunks);
+    for (size_t i = 0; ok && i < job->chunks; i++) {
+        const void* data = job->outputs[i] ? job->outputs[i] : job->input(i);
+        ok = writeAll(fd, data, job->sizes[i] & ~CHUNK_STORED);
+    }
+    if (!ok) {
+        LOGE("Writing %s failed: %s", job->path.string(), strerror(errno));
+    }
+    ok = close(fd) == 0 && ok;
+
+    // The HAL can have its buffer back.
+    job->raw.clear();
+    return ok;
+}
@@ -0,0 +1,102 @@
+#ifndef __RAW_COMPRESSOR_H
+#define __RAW_COMPRESSOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <binder/IMemory.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+namespace android {
+
+// RawCompressor saves raw (Bayer or YUV) still images losslessly
+// compressed, on a pool of worker threads, so that a full-resolution raw
+// frame does not hold up the next capture.
+//
+// An image is cut into CHUNK_SIZE pieces that are deflated independently,
+// at zlib's fastest level, by whichever worker is free; the worker that
+// finishes the last piece writes the file. Independent chunks also let a
+// reader inflate them in parallel. The file is a RawFileHeader, then one
+// uint32_t per chunk giving its stored size (with CHUNK_STORED set if it
+// did not compress and is kept as is), then the chunks back to back.
+class RawCompressor
+{
+public:
+    enum {
+        CHUNK_SIZE = 256 * 1024,
+        RAW_MAGIC = 0x5a574152,     // "RAWZ"
+        RAW_VERSION = 1,
+        CHUNK_STORED = 0x80000000
+    };
+
+    struct RawFileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t chunkSize;
+        uint32_t chunks;
+        uint64_t size;      // of the raw image
+    };
+
+    struct Stats {
+        uint32_t images;
+        uint32_t failures;
+        uint64_t rawBytes;
+        uint64_t storedBytes;
+        // busyTime is summed over the workers; wallTime runs from each
+        // image's arrival to its file being written.
+        nsecs_t busyTime;
+        nsecs_t wallTime;
+    };
+
+    // threads is the size of the pool, 0 for one per online CPU.
+    RawCompressor(int threads = 0, int level = 1);
+    ~RawCompressor();
+
+    status_t start();
+
+    // compress queues raw to be written to path, and returns at once. raw
+    // is held until its file is written.
+    void compress(const sp<IMemory>& raw, const char* path);
+
+    // wait blocks until every image queued so far is written, and returns
+    // the number that failed.
+    int wait();
+
+    void getStats(Stats* stats) const;
+
+private:
+    class Job;
+    class Worker;
+
+    struct Task {
+        sp<Job> job;
+        size_t chunk;
+    };
+
+    bool runTask();
+    void compressChunk(Job* job, size_t chunk);
+    bool writeJob(Job* job);
+
+    const int mThreads;
+    const int mLevel;
+
+    // mMutex guards everything below; mCondition is signalled when a task
+    // is queued or a job finishes.
+    mutable Mutex mMutex;
+    Condition mCondition;
+    Vector<Task> mTasks;
+    Vector< sp<Worker> > mWorkers;
+    int mPendingJobs;
+    int mFailures;
+    bool mQuit;
+    Stats mStats;
+};
+
+}; // namespace android
+
+#endif // __RAW_COMPRESSOR_H
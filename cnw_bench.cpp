@@ -0,0 +1,211 @@
+/*
+ * Host-side load test for CameraNativeWindow.
+ *
+ * Drives the window through the same preview_stream_ops hooks an ICS camera
+ * HAL uses, with producer threads standing in for the HAL's preview thread
+ * and consumer threads using the acquire/release API, then reports
+ * throughput and the window's timing histograms.  Built with
+ * CNW_HOST_BUFFERS so buffers come from HostGraphicBuffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <cutils/atomic.h>
+#include <system/graphics.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include "CameraNativeWindow.h"
+#include "CameraPreviewWindow.h"
+
+using namespace android;
+
+#define MAX_THREADS 16
+
+static struct camera_preview_window    hal;
+static sp<CameraNativeWindow>           window;
+static volatile int32_t                 stopProducers   = 0;
+static volatile int32_t                 stopConsumers   = 0;
+static volatile int32_t                 produced        = 0;
+static volatile int32_t                 consumed        = 0;
+static volatile int32_t                 dequeueFailures = 0;
+static bool                             fillFrames      = false;
+
+static void* producer( void* arg )
+{
+    struct preview_stream_ops* ops = &hal.nw;
+
+    while( !stopProducers ) {
+        buffer_handle_t* handle;
+        int stride;
+
+        if( ops->dequeue_buffer( ops, &handle, &stride ) != 0 ) {
+            android_atomic_inc( &dequeueFailures );
+            // No spinning: it would eat the CPU the consumers are timed on.
+            sched_yield();
+            continue;
+        }
+        ops->lock_buffer( ops, handle );
+
+        // Only the bench knows these are HostGraphicBuffers.
+        GraphicBuffer* gb = static_cast<GraphicBuffer*>(
+                container_of( handle, ANativeWindowBuffer, handle ) );
+        void* vaddr;
+        if( gb->lock( GraphicBuffer::USAGE_SW_WRITE_OFTEN, &vaddr ) == NO_ERROR ) {
+            if( fillFrames ) {
+                memset( vaddr, produced & 0xFF, gb->getSize() );
+            }
+            *(int32_t*)vaddr = produced;
+            gb->unlock();
+        }
+
+        ops->enqueue_buffer( ops, handle );
+        android_atomic_inc( &produced );
+    }
+    return NULL;
+}
+
+static void* consumer( void* arg )
+{
+    volatile uint32_t sum = 0;
+
+    while( !stopConsumers ) {
+        CameraNativeWindow::BufferItem item;
+
+        if( window->acquireBuffer( &item ) != OK ) {
+            sched_yield();
+            continue;
+        }
+
+        void* vaddr;
+        if( window->lockAcquiredBuffer( item.mSlot, &vaddr ) == OK ) {
+            if( fillFrames ) {
+                const uint32_t* p = (const uint32_t*)vaddr;
+                const size_t n = item.mGraphicBuffer->getSize() / sizeof( uint32_t );
+                for( size_t i = 0; i < n; i += 16 ) {
+                    sum += p[i];
+                }
+            } else {
+                sum += *(const uint32_t*)vaddr;
+            }
+        }
+        window->releaseBuffer( item.mSlot );
+        android_atomic_inc( &consumed );
+    }
+    return NULL;
+}
+
+static void usage( const char* program )
+{
+    fprintf( stderr,
+        "Usage: %s [options]\n"
+        "  -t <seconds>   run time (default 5)\n"
+        "  -p <n>         producer threads (default 1)\n"
+        "  -c <n>         consumer threads, 0 to disable the consumer (default 1)\n"
+        "  -n <n>         buffer count (default 6)\n"
+        "  -s <WxH>       buffer size (default 640x480)\n"
+        "  -a             asynchronous mode (swap interval 0)\n"
+        "  -T <ms>        dequeue timeout (default: wait forever)\n"
+        "  -f             write and read every frame in full\n",
+        program );
+}
+
+int main( int argc, char* argv[] )
+{
+    int         seconds     = 5;
+    int         producers   = 1;
+    int         consumers   = 1;
+    int         bufferCount = 6;
+    int         width       = 640;
+    int         height      = 480;
+    bool        async       = false;
+    int         timeoutMs   = 0;
+    int         c;
+    pthread_t   ptid[ MAX_THREADS ];
+    pthread_t   ctid[ MAX_THREADS ];
+
+    while( ( c = getopt( argc, argv, "t:p:c:n:s:aT:fh" ) ) != -1 ) {
+        switch( c ) {
+            case 't': seconds = atoi( optarg ); break;
+            case 'p': producers = atoi( optarg ); break;
+            case 'c': consumers = atoi( optarg ); break;
+            case 'n': bufferCount = atoi( optarg ); break;
+            case 's':
+                if( sscanf( optarg, "%dx%d", &width, &height ) != 2 ) {
+                    usage( argv[0] );
+                    return 1;
+                }
+                break;
+            case 'a': async = true; break;
+            case 'T': timeoutMs = atoi( optarg ); break;
+            case 'f': fillFrames = true; break;
+            default:
+                usage( argv[0] );
+                return 1;
+        }
+    }
+    if( producers < 1 || producers > MAX_THREADS || consumers < 0 || consumers > MAX_THREADS ) {
+        fprintf( stderr, "Thread counts must be within [1, %d]\n", MAX_THREADS );
+        return 1;
+    }
+
+    window = new CameraNativeWindow();
+    window->setConsumerEnabled( consumers > 0 );
+    window->setDequeueTimeout( milliseconds_to_nanoseconds( timeoutMs ) );
+
+    CameraPreviewWindow::init( &hal );
+    hal.window = window.get();
+
+    struct preview_stream_ops* ops = &hal.nw;
+    int minUndequeued = 0;
+    ops->get_min_undequeued_buffer_count( ops, &minUndequeued );
+    if( ops->set_buffer_count( ops, bufferCount ) != 0 ||
+        ops->set_buffers_geometry( ops, width, height, HAL_PIXEL_FORMAT_YCrCb_420_SP ) != 0 ||
+        ops->set_usage( ops, GRALLOC_USAGE_SW_WRITE_OFTEN ) != 0 ||
+        ops->set_swap_interval( ops, async ? 0 : 1 ) != 0 ) {
+        fprintf( stderr, "Failed to configure the window\n" );
+        return 1;
+    }
+
+    fprintf( stderr, "%d producer(s), %d consumer(s), %d buffers (min undequeued %d), %dx%d, %s mode, %ds\n",
+        producers, consumers, bufferCount, minUndequeued, width, height,
+        async ? "async" : "sync", seconds );
+
+    for( int i = 0; i < consumers; i++ ) {
+        pthread_create( &ctid[i], NULL, consumer, NULL );
+    }
+    nsecs_t start = systemTime( SYSTEM_TIME_MONOTONIC );
+    for( int i = 0; i < producers; i++ ) {
+        pthread_create( &ptid[i], NULL, producer, NULL );
+    }
+
+    sleep( seconds );
+
+    // Producers may be waiting on the consumers, so stop them first.
+    android_atomic_inc( &stopProducers );
+    for( int i = 0; i < producers; i++ ) {
+        pthread_join( ptid[i], NULL );
+    }
+    nsecs_t elapsed = systemTime( SYSTEM_TIME_MONOTONIC ) - start;
+    android_atomic_inc( &stopConsumers );
+    for( int i = 0; i < consumers; i++ ) {
+        pthread_join( ctid[i], NULL );
+    }
+
+    double secs = elapsed / 1e9;
+    fprintf( stderr, "produced %d frames (%.0f fps), consumed %d (%.0f fps), dequeue failures %d\n",
+        produced, produced / secs, consumed, consumed / secs, dequeueFailures );
+
+    String8 result;
+    window->dump( result );
+    fprintf( stderr, "%s", result.string() );
+
+    hal.window = NULL;
+    window.clear();
+    return 0;
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+#
+# Generates CameraParameterKeys.h: compile-time ids for the well-known
+# CameraParameters keys and a perfect hash from key string to id.
+#
+#   python3 gen_camera_parameter_keys.py > CameraParameterKeys.h
+#
+# Add new keys to KEYS below and regenerate.  Keys with a KEY_ constant in
+# CameraParameters.h must use the same name and string; snapshot -P checks
+# them against the linked libcamera_client.
+
+import sys
+
+# (id, string, has a CameraParameters::KEY_ constant in CameraParameters.h)
+KEYS = [
+    ("KEY_PREVIEW_SIZE",                     "preview-size",                     True),
+    ("KEY_SUPPORTED_PREVIEW_SIZES",          "preview-size-values",              True),
+    ("KEY_PREVIEW_FPS_RANGE",                "preview-fps-range",                True),
+    ("KEY_SUPPORTED_PREVIEW_FPS_RANGE",      "preview-fps-range-values",         True),
+    ("KEY_PREVIEW_FORMAT",                   "preview-format",                   True),
+    ("KEY_SUPPORTED_PREVIEW_FORMATS",        "preview-format-values",            True),
+    ("KEY_PREVIEW_FRAME_RATE",               "preview-frame-rate",               True),
+    ("KEY_SUPPORTED_PREVIEW_FRAME_RATES",    "preview-frame-rate-values",        True),
+    ("KEY_PICTURE_SIZE",                     "picture-size",                     True),
+    ("KEY_SUPPORTED_PICTURE_SIZES",          "picture-size-values",              True),
+    ("KEY_PICTURE_FORMAT",                   "picture-format",                   True),
+    ("KEY_SUPPORTED_PICTURE_FORMATS",        "picture-format-values",            True),
+    ("KEY_JPEG_THUMBNAIL_WIDTH",             "jpeg-thumbnail-width",             True),
+    ("KEY_JPEG_THUMBNAIL_HEIGHT",            "jpeg-thumbnail-height",            True),
+    ("KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES",   "jpeg-thumbnail-size-values",       True),
+    ("KEY_JPEG_THUMBNAIL_QUALITY",           "jpeg-thumbnail-quality",           True),
+    ("KEY_JPEG_QUALITY",                     "jpeg-quality",                     True),
+    ("KEY_ROTATION",                         "rotation",                         True),
+    ("KEY_GPS_LATITUDE",                     "gps-latitude",                     True),
+    ("KEY_GPS_LONGITUDE",                    "gps-longitude",                    True),
+    ("KEY_GPS_ALTITUDE",                     "gps-altitude",                     True),
+    ("KEY_GPS_TIMESTAMP",                    "gps-timestamp",                    True),
+    ("KEY_GPS_PROCESSING_METHOD",            "gps-processing-method",            True),
+    ("KEY_WHITE_BALANCE",                    "whitebalance",                     True),
+    ("KEY_SUPPORTED_WHITE_BALANCE",          "whitebalance-values",              True),
+    ("KEY_EFFECT",                           "effect",                           True),
+    ("KEY_SUPPORTED_EFFECTS",                "effect-values",                    True),
+    ("KEY_ANTIBANDING",                      "antibanding",                      True),
+    ("KEY_SUPPORTED_ANTIBANDING",            "antibanding-values",               True),
+    ("KEY_SCENE_MODE",                       "scene-mode",                       True),
+    ("KEY_SUPPORTED_SCENE_MODES",            "scene-mode-values",                True),
+    ("KEY_FLASH_MODE",                       "flash-mode",                       True),
+    ("KEY_SUPPORTED_FLASH_MODES",            "flash-mode-values",                True),
+    ("KEY_FOCUS_MODE",                       "focus-mode",                       True),
+    ("KEY_SUPPORTED_FOCUS_MODES",            "focus-mode-values",                True),
+    ("KEY_FOCAL_LENGTH",                     "focal-length",                     True),
+    ("KEY_HORIZONTAL_VIEW_ANGLE",            "horizontal-view-angle",            True),
+    ("KEY_VERTICAL_VIEW_ANGLE",              "vertical-view-angle",              True),
+    ("KEY_EXPOSURE_COMPENSATION",            "exposure-compensation",            True),
+    ("KEY_MAX_EXPOSURE_COMPENSATION",        "max-exposure-compensation",        True),
+    ("KEY_MIN_EXPOSURE_COMPENSATION",        "min-exposure-compensation",        True),
+    ("KEY_EXPOSURE_COMPENSATION_STEP",       "exposure-compensation-step",       True),
+    ("KEY_ZOOM",                             "zoom",                             True),
+    ("KEY_MAX_ZOOM",                         "max-zoom",                         True),
+    ("KEY_ZOOM_RATIOS",                      "zoom-ratios",                      True),
+    ("KEY_ZOOM_SUPPORTED",                   "zoom-supported",                   True),
+    ("KEY_SMOOTH_ZOOM_SUPPORTED",            "smooth-zoom-supported",            True),
+    ("KEY_FOCUS_DISTANCES",                  "focus-distances",                  True),
+    ("KEY_VIDEO_FRAME_FORMAT",               "video-frame-format",               True),
+    # ICS keys, which the CameraParameters.h copy here predates.
+    ("KEY_AUTO_EXPOSURE_LOCK",               "auto-exposure-lock",               False),
+    ("KEY_AUTO_EXPOSURE_LOCK_SUPPORTED",     "auto-exposure-lock-supported",     False),
+    ("KEY_AUTO_WHITEBALANCE_LOCK",           "auto-whitebalance-lock",           False),
+    ("KEY_AUTO_WHITEBALANCE_LOCK_SUPPORTED", "auto-whitebalance-lock-supported", False),
+    ("KEY_MAX_NUM_FOCUS_AREAS",              "max-num-focus-areas",              False),
+    ("KEY_FOCUS_AREAS",                      "focus-areas",                      False),
+    ("KEY_MAX_NUM_METERING_AREAS",           "max-num-metering-areas",           False),
+    ("KEY_METERING_AREAS",                   "metering-areas",                   False),
+    ("KEY_VIDEO_SIZE",                       "video-size",                       False),
+    ("KEY_SUPPORTED_VIDEO_SIZES",            "video-size-values",                False),
+    ("KEY_PREFERRED_PREVIEW_SIZE_FOR_VIDEO", "preferred-preview-size-for-video", False),
+    ("KEY_MAX_NUM_DETECTED_FACES_HW",        "max-num-detected-faces-hw",        False),
+    ("KEY_MAX_NUM_DETECTED_FACES_SW",        "max-num-detected-faces-sw",        False),
+    ("KEY_RECORDING_HINT",                   "recording-hint",                   False),
+    ("KEY_VIDEO_SNAPSHOT_SUPPORTED",         "video-snapshot-supported",         False),
+    ("KEY_VIDEO_STABILIZATION",              "video-stabilization",              False),
+    ("KEY_VIDEO_STABILIZATION_SUPPORTED",    "video-stabilization-supported",    False),
+]
+
+FNV_PRIME = 16777619
+
+
+def fnv1a(seed, s):
+    h = seed
+    for c in s.encode("ascii"):
+        h ^= c
+        h = (h * FNV_PRIME) & 0xffffffff
+    return h
+
+
+def find_hash():
+    # Smallest power-of-two table, then the first seed with no collisions.
+    size = 1
+    while size < 2 * len(KEYS):
+        size *= 2
+    while True:
+        for seed in range(1, 1 << 20):
+            slots = set()
+            for _, s, _ in KEYS:
+                slot = fnv1a(seed, s) & (size - 1)
+                if slot in slots:
+                    break
+                slots.add(slot)
+            else:
+                return seed, size
+        size *= 2
+
+
+def main():
+    seed, size = find_hash()
+    table = [-1] * size
+    for i, (_, s, _) in enumerate(KEYS):
+        table[fnv1a(seed, s) & (size - 1)] = i
+
+    out = sys.stdout.write
+    out("// Generated by gen_camera_parameter_keys.py; do not edit.\n\n")
+    out("#ifndef __CAMERA_PARAMETER_KEYS_H\n#define __CAMERA_PARAMETER_KEYS_H\n\n")
+    out("#include <stdint.h>\n#include <string.h>\n\n")
+    out("namespace android {\n\n")
+    out("// CameraParameterKey gives every well-known CameraParameters key a dense\n")
+    out("// id, so that parsed parameters can be indexed by key in O(1), and maps\n")
+    out("// key strings to ids with a perfect hash.\n")
+    out("struct CameraParameterKey\n{\n")
+    out("    enum Id {\n")
+    for i, (name, _, _) in enumerate(KEYS):
+        out("        %s = %d,\n" % (name, i))
+    out("        COUNT = %d,\n" % len(KEYS))
+    out("        UNKNOWN = -1\n")
+    out("    };\n\n")
+    out("    static const char* name(Id id) {\n")
+    out("        static const char* const sNames[COUNT] = {\n")
+    for _, s, _ in KEYS:
+        out("            \"%s\",\n" % s)
+    out("        };\n")
+    out("        return sNames[id];\n")
+    out("    }\n\n")
+    out("    // lookup returns the id of key, or UNKNOWN for any other string.\n")
+    out("    static Id lookup(const char* key) {\n")
+    out("        static const int8_t sSlots[%d] = {" % size)
+    for i, v in enumerate(table):
+        if i % 16 == 0:
+            out("\n            ")
+        out("%d," % v + (" " if i % 16 != 15 else ""))
+    out("\n        };\n")
+    out("        uint32_t h = %du;\n" % seed)
+    out("        for (const char* p = key; *p; p++) {\n")
+    out("            h = (h ^ (uint8_t)*p) * %du;\n" % FNV_PRIME)
+    out("        }\n")
+    out("        int slot = sSlots[h & %d];\n" % (size - 1))
+    out("        if (slot < 0 || strcmp(key, name(Id(slot))) != 0) {\n")
+    out("            return UNKNOWN;\n")
+    out("        }\n")
+    out("        return Id(slot);\n")
+    out("    }\n")
+    out("};\n\n")
+    out("// X-macro over the ids that have a CameraParameters::KEY_ constant of the\n")
+    out("// same name.\n")
+    out("#define CAMERA_PARAMETER_KEY_CONSTANTS(X) \\\n")
+    consts = [name for name, _, has in KEYS if has]
+    for i, name in enumerate(consts):
+        out("    X(%s)%s\n" % (name, " \\" if i + 1 < len(consts) else ""))
+    out("\n}; // namespace android\n\n")
+    out("#endif // __CAMERA_PARAMETER_KEYS_H\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -7,11 +7,13 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <signal.h>
 #include <libgen.h>     // for basename()
+#include <time.h>
 #include <unistd.h>
-#include <pthread.h>
 #include <utils/Log.h>
+#include <cutils/properties.h>
 #include <hardware/camera.h>
 #include <camera/CameraParameters.h>
 
@@ -30,56 +32,101 @@
 #undef CameraHardwareInterface
 
 #include "CameraNativeWindow.h"
+#include "CameraFrameFaces.h"
+#include "CameraCommandThread.h"
+#include "CameraParametersFlat.h"
+#include "CameraCapabilities.h"
+#include "ImageWriter.h"
+#include "RawCompressor.h"
+#include "CameraEventQueue.h"
 
 using namespace android;
 
 /*
-    Events framework
+    Events framework: callbacks on any thread post events, each with its
+    own payload and timestamp, and the event loop in main() takes them in
+    order.  Nothing is overwritten, so callbacks that arrive back to back
+    (shutter, raw, JPEG) are all seen.
 */
 typedef enum {
     NO_EVENT,
     PREVIEW_STARTED,
     AUTO_FOCUSED,
+    SHUTTER,
+    RAW_CAPTURED,
     IMAGE_CAPTURED,
+    CAMERA_DONE,
     ABORT,
     ERROR
 } CAM_EVENT;
 
-static volatile CAM_EVENT   event   = NO_EVENT;
-static pthread_mutex_t      lock    = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t       cond    = PTHREAD_COND_INITIALIZER;
+static CameraEventQueue events;
 
-static void fireEvent( CAM_EVENT e )
+/*
+    What one camera's HAL callbacks report to: its event queue, and the
+    little state they keep between calls.  A pointer to it is the 'user'
+    argument of every callback.
+*/
+typedef struct CallbackContext {
+    CallbackContext( CameraEventQueue* q ) : events( q ), previewFrames( 0 ), previewStarted( false ) { faces.clear(); }
+
+    CameraEventQueue*   events;
+    int                 previewFrames;
+    bool                previewStarted;
+    /* Only touched from the HAL's callback thread. */
+    CameraFrameFaces    faces;
+} CallbackContext;
+
+/* The camera driven by main()'s own event loop. */
+static CallbackContext mainCallbacks( &events );
+
+static void fireEvent( CAM_EVENT e, int32_t ext1 = 0, const sp<IMemory>& data = NULL )
 {
     LOGD( "fireEvent %d", e );
-    
-    pthread_mutex_lock( &lock );
-    event = e;
-    pthread_cond_signal( &cond );
-    pthread_mutex_unlock( &lock );
+    events.post( e, ext1, 0, data );
 }
 
+static void fireEvent( void* user, CAM_EVENT e, int32_t ext1 = 0, const sp<IMemory>& data = NULL )
+{
+    LOGD( "fireEvent %d", e );
+    ( (CallbackContext*)user )->events->post( e, ext1, 0, data );
+}
+
+/*
+    A signal can land on any thread, including one that holds the event
+    queue's lock or malloc's, so the handler only sets a flag; waitEvent()
+    turns it into an ABORT event.
+*/
+static volatile sig_atomic_t interrupted = 0;
+
 static void handleSigInt( int sig )
 {
-    switch( sig ) {
-        case SIGINT:
-            printf( "\nGot SIGINT, exiting...\n" );
-            fireEvent( ABORT );
-            break;
-        
-        default:
-            printf( "\nGot signal %d\n", sig );
-            break;
+    static const char message[] = "\nGot SIGINT, exiting...\n";
+    write( STDOUT_FILENO, message, sizeof( message ) - 1 );
+    interrupted = 1;
+}
+
+/* How often a waiting event loop looks at the SIGINT flag. */
+#define SIGNAL_POLL_INTERVAL    100000000LL     /* ns */
+
+static void waitEvent( CameraEvent* event )
+{
+    for( ;; ) {
+        if( interrupted ) {
+            interrupted = 0;
+            *event = CameraEvent();
+            event->type = ABORT;
+            event->timestamp = systemTime( SYSTEM_TIME_MONOTONIC );
+            return;
+        }
+        if( events.waitRelative( event, SIGNAL_POLL_INTERVAL ) == OK ) {
+            return;
+        }
     }
 }
 
 typedef void (*notify_callback_t)( int32_t msgType, int32_t ext1, int32_t ext2, void* user );
-#define NO_METADATA 1
-#if NO_METADATA
-typedef void (*data_callback_t)( int32_t msgType, const sp<IMemory> &dataPtr, void* user );
-#else
 typedef void (*data_callback_t)( int32_t msgType, const sp<IMemory> &dataPtr, camera_frame_metadata_t* metadata, void* user );
-#endif
 typedef void (*data_callback_timestamp_t)( nsecs_t timestamp, int32_t msgType, const sp<IMemory> &dataPtr, void* user );
 
 static void snapshot_notify_callback( int32_t msgType, int32_t ext1, int32_t ext2, void* user )
@@ -88,55 +135,158 @@ static void snapshot_notify_callback( int32_t msgType, int32_t ext1, int32_t ext
         case android::CAMERA_MSG_FOCUS:
             if( ext1 ) {
                 LOGD( "Autofocus complete" );
-                fireEvent( AUTO_FOCUSED );
+                fireEvent( user, AUTO_FOCUSED );
             } else {
                 LOGD( "Autofocus failed" );
-                fireEvent( ERROR );
+                fireEvent( user, ERROR );
             }
             break;
 
+        case android::CAMERA_MSG_SHUTTER:
+            fireEvent( user, SHUTTER );
+            break;
+
+        case android::CAMERA_MSG_RAW_IMAGE_NOTIFY:
+            fireEvent( user, RAW_CAPTURED );
+            break;
+
         default:
             LOGD( "Unhandled notify_callback msgType: %d", msgType );
             break;
     }
 }
 
-static volatile char* data;
-static volatile size_t length;
+/*
+    Preview sweep: measures the frames the HAL delivers between start()
+    and stop().  Preview callbacks carry no timestamp, so frames are timed
+    on arrival, which includes the HAL's own callback jitter.
+*/
+class PreviewMeter
+{
+public:
+    PreviewMeter() : mRunning( false ) { reset( 0 ); }
+
+    /*
+        period is the longest frame interval the configuration allows; only
+        gaps well beyond it count as drops.
+    */
+    void start( nsecs_t period )
+    {
+        Mutex::Autolock l( mMutex );
+        reset( period );
+        mRunning = true;
+    }
+
+    void stop()
+    {
+        Mutex::Autolock l( mMutex );
+        mRunning = false;
+    }
+
+    void frame( nsecs_t now )
+    {
+        Mutex::Autolock l( mMutex );
+        if( !mRunning ) {
+            return;
+        }
+        if( mFrames > 0 ) {
+            nsecs_t dt = now - mLast;
+            mSum += dt;
+            mSumSquares += (double)dt * dt;
+            mMaxInterval = dt > mMaxInterval ? dt : mMaxInterval;
+            /* An interval of n periods, give or take half of one, means n - 1 frames went missing. */
+            if( mPeriod > 0 && dt > mPeriod + mPeriod / 2 ) {
+                mDropped += ( dt + mPeriod / 2 ) / mPeriod - 1;
+            }
+        } else {
+            mFirst = now;
+        }
+        mLast = now;
+        mFrames += 1;
+    }
+
+    void report( FILE* out, const char* size, const char* format, const char* range, double cpu ) const
+    {
+        Mutex::Autolock l( mMutex );
+        int intervals = mFrames > 1 ? mFrames - 1 : 0;
+        double mean = intervals ? (double)mSum / intervals : 0;
+        double jitter = intervals ? sqrt( mSumSquares / intervals - mean * mean ) : 0;
+        double fps = mean > 0 ? 1e9 / mean : 0;
+        fprintf( out, "%-10s %-12s %-13s %6d %7.2f %7.2f %8.2f %6d %6.1f%%\n",
+            size, format, range, mFrames, fps, jitter / 1e6, mMaxInterval / 1e6, mDropped,
+            cpu * 100 );
+    }
+
+private:
+    void reset( nsecs_t period )
+    {
+        mPeriod = period;
+        mFrames = 0;
+        mFirst = mLast = 0;
+        mSum = 0;
+        mSumSquares = 0;
+        mMaxInterval = 0;
+        mDropped = 0;
+    }
+
+    mutable Mutex   mMutex;
+    bool            mRunning;
+    nsecs_t         mPeriod;
+    int             mFrames;
+    nsecs_t         mFirst;
+    nsecs_t         mLast;
+    nsecs_t         mSum;
+    double          mSumSquares;
+    nsecs_t         mMaxInterval;
+    int             mDropped;
+};
+
+static PreviewMeter previewMeter;
 
-#if NO_METADATA
-static void snapshot_data_callback( int32_t msgType, const sp<IMemory> &dataPtr, void* user )
-#else
 static void snapshot_data_callback( int32_t msgType, const sp<IMemory> &dataPtr, camera_frame_metadata_t* metadata, void* user )
-#endif
 {
-    static int previewFrames = 0;
-    static bool previewStarted = false;
+    CallbackContext* context = (CallbackContext*)user;
+    CameraFrameFaces& faces = context->faces;
 
     switch( msgType ) {
         case android::CAMERA_MSG_PREVIEW_FRAME:
-            previewFrames += 1;
-            if( previewFrames == 30 ) {
+            previewMeter.frame( systemTime( SYSTEM_TIME_MONOTONIC ) );
+            context->previewFrames += 1;
+            if( context->previewFrames == 30 ) {
                 LOGD( "Got 30 preview frames" );
-                previewFrames = 0;
+                context->previewFrames = 0;
+            }
+            if( !context->previewStarted ) {
+                fireEvent( user, PREVIEW_STARTED );
+                context->previewStarted = true;
             }
-            if( !previewStarted ) {
-                fireEvent( PREVIEW_STARTED );
-                previewStarted = true;
+            break;
+
+        case android::CAMERA_MSG_PREVIEW_METADATA: {
+            int32_t before = faces.numFaces;
+            faces.set( metadata, systemTime( SYSTEM_TIME_MONOTONIC ) );
+            if( faces.numFaces != before ) {
+                LOGD( "Detected %d face(s)", faces.numFaces );
+                for( int32_t i = 0; i < faces.numStored; i++ ) {
+                    const CameraFace& f = faces.faces[i];
+                    LOGD( "  face %d: [%d, %d, %d, %d] score %d", f.id,
+                        f.rect[0], f.rect[1], f.rect[2], f.rect[3], f.score );
+                }
             }
             break;
+        }
             
+        case android::CAMERA_MSG_RAW_IMAGE:
+            fireEvent( user, RAW_CAPTURED, 0, dataPtr );
+            break;
+
         case android::CAMERA_MSG_COMPRESSED_IMAGE:
-            length = dataPtr->size();
-            LOGD( "Got compressed image: data=%p, length=%d", dataPtr->pointer(), length );
-            data = (char*)malloc( length );
-            if( data ) {
-                memcpy( (void*)data, dataPtr->pointer(), length );
-                fireEvent( IMAGE_CAPTURED );
-            } else {
-                LOGE( "Failed to allocate %d bytes for compressed image", length );
-                fireEvent( ERROR );
-            }
+            /*
+                The JPEG stays in the HAL's own buffer, rather than being
+                copied out, until the writer is done with it.
+            */
+            LOGD( "Got compressed image: data=%p, length=%d", dataPtr->pointer(), dataPtr->size() );
+            fireEvent( user, IMAGE_CAPTURED, 0, dataPtr );
             break;
 
         default:
@@ -154,7 +304,169 @@ static void snapshot_data_callback_timestamp( nsecs_t timestamp, int32_t msgType
     }
 }
 
-static CameraHardwareInterface_ICS* getCamera( camera_module_t* module, uint32_t whichOne )
+/*
+    Slow HAL calls go through a command thread so that the event loop keeps
+    running while the HAL blocks; failures come back as ERROR events.
+*/
+typedef CameraCommandThread<CameraHardwareInterface_ICS> CommandThread;
+
+static void snapshot_command_error( const char* command, status_t status, void* user )
+{
+    fprintf( stderr, "%s failed (%d)\n", command, status );
+    LOGE( "%s failed: %d", command, status );
+    fireEvent( user, ERROR, status );
+}
+
+/*
+    "/data/snapshot.jpg" becomes "/data/snapshot-007.jpg" for shot 7 of a
+    burst; a single shot keeps the name it was given.
+*/
+static String8 burstPath( const char* ofile, int shot, int shots )
+{
+    if( shots == 1 ) {
+        return String8( ofile );
+    }
+    const char* dot = strrchr( ofile, '.' );
+    const char* slash = strrchr( ofile, '/' );
+    if( !dot || ( slash && dot < slash ) ) {
+        dot = ofile + strlen( ofile );
+    }
+    String8 path( ofile, dot - ofile );
+    path.appendFormat( "-%03d%s", shot, dot );
+    return path;
+}
+
+/*
+    The raw image of a shot is saved next to its JPEG, with the extension
+    swapped: "/data/snapshot-007.raw", or ".rawz" when compressed.
+*/
+static String8 rawPath( const char* ofile, int shot, int shots, bool compressed )
+{
+    String8 path = burstPath( ofile, shot, shots );
+    const char* dot = strrchr( path.string(), '.' );
+    const char* slash = strrchr( path.string(), '/' );
+    if( dot && ( !slash || dot > slash ) ) {
+        path = String8( path.string(), dot - path.string() );
+    }
+    path.append( compressed ? ".rawz" : ".raw" );
+    return path;
+}
+
+/*
+    Benchmark mode: the monotonic time of every step of one capture cycle,
+    0 for a step that did not happen (no autofocus with -n, or a HAL that
+    never reports the raw image).  The "issued" times are when the command
+    thread made the HAL call, not when it was queued behind, say, a
+    startPreview().
+*/
+typedef struct {
+    nsecs_t focusIssued;
+    nsecs_t focused;
+    nsecs_t takeIssued;
+    nsecs_t shutter;
+    nsecs_t raw;
+    nsecs_t jpeg;
+} CaptureTiming;
+
+typedef struct {
+    const char* name;
+    size_t      from;       // offsets into CaptureTiming
+    size_t      to;
+} BenchmarkPhase;
+
+#define TIMING( field ) offsetof( CaptureTiming, field )
+
+static const BenchmarkPhase phases[] = {
+    { "autofocus",      TIMING( focusIssued ),  TIMING( focused ) },
+    { "shutter_lag",    TIMING( takeIssued ),   TIMING( shutter ) },
+    { "shutter_to_raw", TIMING( shutter ),      TIMING( raw ) },
+    { "raw_to_jpeg",    TIMING( raw ),          TIMING( jpeg ) },
+    { "shutter_to_jpeg", TIMING( shutter ),     TIMING( jpeg ) },
+    { "capture",        TIMING( takeIssued ),   TIMING( jpeg ) },
+};
+
+#undef TIMING
+
+static nsecs_t timingAt( const CaptureTiming& t, size_t offset )
+{
+    return *(const nsecs_t*)( (const char*)&t + offset );
+}
+
+static int compareNsecs( const void* a, const void* b )
+{
+    nsecs_t l = *(const nsecs_t*)a;
+    nsecs_t r = *(const nsecs_t*)b;
+    return l < r ? -1 : l > r;
+}
+
+/* Nearest-rank percentile of the sorted samples[0..n). */
+static nsecs_t percentile( const nsecs_t* samples, size_t n, int p )
+{
+    size_t rank = ( n * p + 99 ) / 100;
+    return samples[ rank ? rank - 1 : 0 ];
+}
+
+/*
+    Prints a p50/p90/p99 table per phase to 'out' and, if 'json' is set,
+    writes the same summary and every raw sample there as JSON.
+*/
+static void reportBenchmark( const Vector<CaptureTiming>& timings, FILE* out, FILE* json, const char* board, uint32_t whichOne )
+{
+    size_t n = timings.size();
+    nsecs_t* samples = new nsecs_t[ n ? n : 1 ];
+
+    fprintf( out, "%-16s %5s %9s %9s %9s %9s %9s\n", "phase (ms)", "n", "min", "p50", "p90", "p99", "max" );
+    if( json ) {
+        fprintf( json, "{\n  \"board\": \"%s\",\n  \"camera\": %d,\n  \"cycles\": %d,\n  \"phases\": {", board, whichOne, n );
+    }
+    for( size_t i = 0; i < sizeof( phases ) / sizeof( phases[0] ); i++ ) {
+        size_t m = 0;
+        for( size_t j = 0; j < n; j++ ) {
+            nsecs_t from = timingAt( timings[j], phases[i].from );
+            nsecs_t to = timingAt( timings[j], phases[i].to );
+            if( from && to ) {
+                samples[ m++ ] = to - from;
+            }
+        }
+        if( json ) {
+            fprintf( json, "%s\n    \"%s\": { \"n\": %d", i ? "," : "", phases[i].name, m );
+        }
+        if( m == 0 ) {
+            fprintf( out, "%-16s %5d %9s %9s %9s %9s %9s\n", phases[i].name, 0, "-", "-", "-", "-", "-" );
+            if( json ) {
+                fprintf( json, " }" );
+            }
+            continue;
+        }
+        qsort( samples, m, sizeof( nsecs_t ), compareNsecs );
+        fprintf( out, "%-16s %5d %9.1f %9.1f %9.1f %9.1f %9.1f\n", phases[i].name, m,
+            samples[0] / 1e6, percentile( samples, m, 50 ) / 1e6, percentile( samples, m, 90 ) / 1e6,
+            percentile( samples, m, 99 ) / 1e6, samples[ m - 1 ] / 1e6 );
+        if( json ) {
+            fprintf( json, ", \"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }",
+                samples[0] / 1e6, percentile( samples, m, 50 ) / 1e6, percentile( samples, m, 90 ) / 1e6,
+                percentile( samples, m, 99 ) / 1e6, samples[ m - 1 ] / 1e6 );
+        }
+    }
+    delete[] samples;
+
+    if( json ) {
+        /* Raw timestamps too, relative to the start of each cycle, so that other tools can slice them differently. */
+        fprintf( json, "\n  },\n  \"samples_ns\": [" );
+        for( size_t j = 0; j < n; j++ ) {
+            const CaptureTiming& t = timings[j];
+            nsecs_t t0 = t.focusIssued ? t.focusIssued : t.takeIssued;
+            fprintf( json, "%s\n    { \"focus_issued\": %lld, \"focused\": %lld, \"take_issued\": %lld, \"shutter\": %lld, \"raw\": %lld, \"jpeg\": %lld }",
+                j ? "," : "",
+                t.focusIssued ? t.focusIssued - t0 : -1LL, t.focused ? t.focused - t0 : -1LL,
+                t.takeIssued ? t.takeIssued - t0 : -1LL, t.shutter ? t.shutter - t0 : -1LL,
+                t.raw ? t.raw - t0 : -1LL, t.jpeg ? t.jpeg - t0 : -1LL );
+        }
+        fprintf( json, "\n  ]\n}\n" );
+    }
+}
+
+static CameraHardwareInterface_ICS* getCamera( camera_module_t* module, uint32_t whichOne, CallbackContext* callbacks )
 {
     CameraHardwareInterface_ICS* camera;
     char camName[ 4 ];
@@ -170,87 +482,718 @@ static CameraHardwareInterface_ICS* getCamera( camera_module_t* module, uint32_t
     fprintf( stderr, "Camera initialized\n" );
     LOGD( "Camera initialized" );
     
-    camera->setCallbacks( snapshot_notify_callback, snapshot_data_callback, snapshot_data_callback_timestamp, NULL );
+    camera->setCallbacks( snapshot_notify_callback, NULL, snapshot_data_callback_timestamp, callbacks );
+    camera->setMetadataCallback( snapshot_data_callback );
     return camera;
 }
 
 static void dumpSupportedParameters( sp<CameraHardwareInterface_ICS> camera, uint32_t whichOne )
 {
-    CameraParameters p = camera->getParameters();
+    FlatCameraParameters p( camera->getParametersString().string() );
     
     fprintf( stderr, "Supported camera properties (camera %d):\n", whichOne );
-    fprintf( stderr, "\tPreview sizes:                 %s\n", p.get( p.KEY_SUPPORTED_PREVIEW_SIZES ) );
-    fprintf( stderr, "\tPreview FPS ranges:            %s\n", p.get( p.KEY_SUPPORTED_PREVIEW_FPS_RANGE ) );
-    fprintf( stderr, "\tPreview formats:               %s\n", p.get( p.KEY_SUPPORTED_PREVIEW_FORMATS ) );
-    fprintf( stderr, "\tPreview frame rates:           %s\n", p.get( p.KEY_SUPPORTED_PREVIEW_FRAME_RATES ) );
-    fprintf( stderr, "\tPicture sizes:                 %s\n", p.get( p.KEY_SUPPORTED_PICTURE_SIZES ) );
-    fprintf( stderr, "\tPicture formats:               %s\n", p.get( p.KEY_SUPPORTED_PICTURE_FORMATS ) );
-    fprintf( stderr, "\tJPEG thumbnail sizes:          %s\n", p.get( p.KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES ) );
-    fprintf( stderr, "\tWhite balances:                %s\n", p.get( p.KEY_SUPPORTED_WHITE_BALANCE ) );
-    fprintf( stderr, "\tEffects:                       %s\n", p.get( p.KEY_SUPPORTED_EFFECTS ) );
-    fprintf( stderr, "\tAnti-banding:                  %s\n", p.get( p.KEY_SUPPORTED_ANTIBANDING ) );
-    fprintf( stderr, "\tScene modes:                   %s\n", p.get( p.KEY_SUPPORTED_SCENE_MODES ) );
-    fprintf( stderr, "\tFlash modes:                   %s\n", p.get( p.KEY_SUPPORTED_FLASH_MODES ) );
-    fprintf( stderr, "\tFocus modes:                   %s\n", p.get( p.KEY_SUPPORTED_FOCUS_MODES ) );
-    fprintf( stderr, "\tFocal length:                  %s\n", p.get( p.KEY_FOCAL_LENGTH ) );
-    fprintf( stderr, "\tHorizontal view angle:         %s\n", p.get( p.KEY_HORIZONTAL_VIEW_ANGLE ) );
-    fprintf( stderr, "\tVertical view angle:           %s\n", p.get( p.KEY_VERTICAL_VIEW_ANGLE ) );
-    fprintf( stderr, "\tMaximum exposure compensation: %s\n", p.get( p.KEY_MAX_EXPOSURE_COMPENSATION ) );
-    fprintf( stderr, "\tMinimum exposure compensation: %s\n", p.get( p.KEY_MIN_EXPOSURE_COMPENSATION ) );
-    fprintf( stderr, "\tExposure compensation step:    %s\n", p.get( p.KEY_EXPOSURE_COMPENSATION_STEP ) );
-    fprintf( stderr, "\tMaximum zoom:                  %s\n", p.get( p.KEY_MAX_ZOOM ) );
-    fprintf( stderr, "\tZoom ratios:                   %s\n", p.get( p.KEY_ZOOM_RATIOS ) );
-    fprintf( stderr, "\tZoom supported:                %s\n", p.get( p.KEY_ZOOM_SUPPORTED ) );
-    fprintf( stderr, "\tSmooth zoom supported:         %s\n", p.get( p.KEY_SMOOTH_ZOOM_SUPPORTED ) );
+    fprintf( stderr, "\tPreview sizes:                 %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PREVIEW_SIZES ) );
+    fprintf( stderr, "\tPreview FPS ranges:            %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PREVIEW_FPS_RANGE ) );
+    fprintf( stderr, "\tPreview formats:               %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PREVIEW_FORMATS ) );
+    fprintf( stderr, "\tPreview frame rates:           %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PREVIEW_FRAME_RATES ) );
+    fprintf( stderr, "\tPicture sizes:                 %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PICTURE_SIZES ) );
+    fprintf( stderr, "\tPicture formats:               %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_PICTURE_FORMATS ) );
+    fprintf( stderr, "\tJPEG thumbnail sizes:          %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES ) );
+    fprintf( stderr, "\tWhite balances:                %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_WHITE_BALANCE ) );
+    fprintf( stderr, "\tEffects:                       %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_EFFECTS ) );
+    fprintf( stderr, "\tAnti-banding:                  %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_ANTIBANDING ) );
+    fprintf( stderr, "\tScene modes:                   %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_SCENE_MODES ) );
+    fprintf( stderr, "\tFlash modes:                   %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_FLASH_MODES ) );
+    fprintf( stderr, "\tFocus modes:                   %s\n", p.get( CameraParameterKey::KEY_SUPPORTED_FOCUS_MODES ) );
+    fprintf( stderr, "\tFocal length:                  %s\n", p.get( CameraParameterKey::KEY_FOCAL_LENGTH ) );
+    fprintf( stderr, "\tHorizontal view angle:         %s\n", p.get( CameraParameterKey::KEY_HORIZONTAL_VIEW_ANGLE ) );
+    fprintf( stderr, "\tVertical view angle:           %s\n", p.get( CameraParameterKey::KEY_VERTICAL_VIEW_ANGLE ) );
+    fprintf( stderr, "\tMaximum exposure compensation: %s\n", p.get( CameraParameterKey::KEY_MAX_EXPOSURE_COMPENSATION ) );
+    fprintf( stderr, "\tMinimum exposure compensation: %s\n", p.get( CameraParameterKey::KEY_MIN_EXPOSURE_COMPENSATION ) );
+    fprintf( stderr, "\tExposure compensation step:    %s\n", p.get( CameraParameterKey::KEY_EXPOSURE_COMPENSATION_STEP ) );
+    fprintf( stderr, "\tMaximum zoom:                  %s\n", p.get( CameraParameterKey::KEY_MAX_ZOOM ) );
+    fprintf( stderr, "\tZoom ratios:                   %s\n", p.get( CameraParameterKey::KEY_ZOOM_RATIOS ) );
+    fprintf( stderr, "\tZoom supported:                %s\n", p.get( CameraParameterKey::KEY_ZOOM_SUPPORTED ) );
+    fprintf( stderr, "\tSmooth zoom supported:         %s\n", p.get( CameraParameterKey::KEY_SMOOTH_ZOOM_SUPPORTED ) );
 }
 
 static void dumpCurrentParameters( sp<CameraHardwareInterface_ICS> camera, uint32_t whichOne )
 {
-    CameraParameters p = camera->getParameters();
+    FlatCameraParameters p( camera->getParametersString().string() );
     
     fprintf( stderr, "Current camera properties (camera %d):\n", whichOne );
-    fprintf( stderr, "\tPreview size:                  %s\n", p.get( p.KEY_PREVIEW_SIZE ) );
-    fprintf( stderr, "\tPreview FPS range:             %s\n", p.get( p.KEY_PREVIEW_FPS_RANGE ) );
-    fprintf( stderr, "\tPreview format:                %s\n", p.get( p.KEY_PREVIEW_FORMAT ) );
-    fprintf( stderr, "\tPreview frame rate:            %s\n", p.get( p.KEY_PREVIEW_FRAME_RATE ) );
-    fprintf( stderr, "\tPicture size:                  %s\n", p.get( p.KEY_PICTURE_SIZE ) );
-    fprintf( stderr, "\tPicture format:                %s\n", p.get( p.KEY_PICTURE_FORMAT ) );
-    fprintf( stderr, "\tJPEG thumbnail width:          %s\n", p.get( p.KEY_JPEG_THUMBNAIL_WIDTH ) );
-    fprintf( stderr, "\tJPEG thumbnail height:         %s\n", p.get( p.KEY_JPEG_THUMBNAIL_HEIGHT ) );
-    fprintf( stderr, "\tWhite balance:                 %s\n", p.get( p.KEY_WHITE_BALANCE ) );
-    fprintf( stderr, "\tEffect:                        %s\n", p.get( p.KEY_EFFECT ) );
-    fprintf( stderr, "\tAnti-banding:                  %s\n", p.get( p.KEY_ANTIBANDING ) );
-    fprintf( stderr, "\tScene mode:                    %s\n", p.get( p.KEY_SCENE_MODE ) );
-    fprintf( stderr, "\tFlash mode:                    %s\n", p.get( p.KEY_FLASH_MODE ) );
-    fprintf( stderr, "\tFocus mode:                    %s\n", p.get( p.KEY_FOCUS_MODE ) );
-    fprintf( stderr, "\tFocal length:                  %s\n", p.get( p.KEY_FOCAL_LENGTH ) );
-    fprintf( stderr, "\tHorizontal view angle:         %s\n", p.get( p.KEY_HORIZONTAL_VIEW_ANGLE ) );
-    fprintf( stderr, "\tVertical view angle:           %s\n", p.get( p.KEY_VERTICAL_VIEW_ANGLE ) );
-    fprintf( stderr, "\tMaximum exposure compensation: %s\n", p.get( p.KEY_MAX_EXPOSURE_COMPENSATION ) );
-    fprintf( stderr, "\tMinimum exposure compensation: %s\n", p.get( p.KEY_MIN_EXPOSURE_COMPENSATION ) );
-    fprintf( stderr, "\tExposure compensation step:    %s\n", p.get( p.KEY_EXPOSURE_COMPENSATION_STEP ) );
-    fprintf( stderr, "\tMaximum zoom:                  %s\n", p.get( p.KEY_MAX_ZOOM ) );
-    fprintf( stderr, "\tZoom:                          %s\n", p.get( p.KEY_ZOOM_SUPPORTED ) );
-    fprintf( stderr, "\tSmooth zoom:                   %s\n", p.get( p.KEY_SMOOTH_ZOOM_SUPPORTED ) );
+    fprintf( stderr, "\tPreview size:                  %s\n", p.get( CameraParameterKey::KEY_PREVIEW_SIZE ) );
+    fprintf( stderr, "\tPreview FPS range:             %s\n", p.get( CameraParameterKey::KEY_PREVIEW_FPS_RANGE ) );
+    fprintf( stderr, "\tPreview format:                %s\n", p.get( CameraParameterKey::KEY_PREVIEW_FORMAT ) );
+    fprintf( stderr, "\tPreview frame rate:            %s\n", p.get( CameraParameterKey::KEY_PREVIEW_FRAME_RATE ) );
+    fprintf( stderr, "\tPicture size:                  %s\n", p.get( CameraParameterKey::KEY_PICTURE_SIZE ) );
+    fprintf( stderr, "\tPicture format:                %s\n", p.get( CameraParameterKey::KEY_PICTURE_FORMAT ) );
+    fprintf( stderr, "\tJPEG thumbnail width:          %s\n", p.get( CameraParameterKey::KEY_JPEG_THUMBNAIL_WIDTH ) );
+    fprintf( stderr, "\tJPEG thumbnail height:         %s\n", p.get( CameraParameterKey::KEY_JPEG_THUMBNAIL_HEIGHT ) );
+    fprintf( stderr, "\tWhite balance:                 %s\n", p.get( CameraParameterKey::KEY_WHITE_BALANCE ) );
+    fprintf( stderr, "\tEffect:                        %s\n", p.get( CameraParameterKey::KEY_EFFECT ) );
+    fprintf( stderr, "\tAnti-banding:                  %s\n", p.get( CameraParameterKey::KEY_ANTIBANDING ) );
+    fprintf( stderr, "\tScene mode:                    %s\n", p.get( CameraParameterKey::KEY_SCENE_MODE ) );
+    fprintf( stderr, "\tFlash mode:                    %s\n", p.get( CameraParameterKey::KEY_FLASH_MODE ) );
+    fprintf( stderr, "\tFocus mode:                    %s\n", p.get( CameraParameterKey::KEY_FOCUS_MODE ) );
+    fprintf( stderr, "\tFocal length:                  %s\n", p.get( CameraParameterKey::KEY_FOCAL_LENGTH ) );
+    fprintf( stderr, "\tHorizontal view angle:         %s\n", p.get( CameraParameterKey::KEY_HORIZONTAL_VIEW_ANGLE ) );
+    fprintf( stderr, "\tVertical view angle:           %s\n", p.get( CameraParameterKey::KEY_VERTICAL_VIEW_ANGLE ) );
+    fprintf( stderr, "\tMaximum exposure compensation: %s\n", p.get( CameraParameterKey::KEY_MAX_EXPOSURE_COMPENSATION ) );
+    fprintf( stderr, "\tMinimum exposure compensation: %s\n", p.get( CameraParameterKey::KEY_MIN_EXPOSURE_COMPENSATION ) );
+    fprintf( stderr, "\tExposure compensation step:    %s\n", p.get( CameraParameterKey::KEY_EXPOSURE_COMPENSATION_STEP ) );
+    fprintf( stderr, "\tMaximum zoom:                  %s\n", p.get( CameraParameterKey::KEY_MAX_ZOOM ) );
+    fprintf( stderr, "\tZoom:                          %s\n", p.get( CameraParameterKey::KEY_ZOOM_SUPPORTED ) );
+    fprintf( stderr, "\tSmooth zoom:                   %s\n", p.get( CameraParameterKey::KEY_SMOOTH_ZOOM_SUPPORTED ) );
 }
 
-static bool setParameter( sp<CameraHardwareInterface_ICS> camera, const char* key, const char* value )
+/*
+    Multi-camera capture: every camera the HAL will open at once gets a
+    CameraContext with its own callbacks, event queue, worker thread and
+    writer.  The workers meet at a CaptureBarrier before each shot so that
+    the takePicture() calls go out together and the skew between the
+    cameras' shutters says something about the HAL rather than about us.
+*/
+class CaptureBarrier
 {
-    CameraParameters p = camera->getParameters();
-    
-    fprintf( stderr, "Setting '%s' to '%s'...", key, value );
+public:
+    CaptureBarrier() : mParties( 0 ), mWaiting( 0 ), mGeneration( 0 ), mCancelled( false ) { }
+
+    void add()
+    {
+        Mutex::Autolock l( mMutex );
+        mParties += 1;
+    }
+
+    /* Waits for every remaining party; false if the barrier was cancelled. */
+    bool arrive()
+    {
+        Mutex::Autolock l( mMutex );
+        int generation = mGeneration;
+        mWaiting += 1;
+        releaseLocked();
+        while( generation == mGeneration && !mCancelled ) {
+            mCondition.wait( mMutex );
+        }
+        return !mCancelled;
+    }
+
+    /* A party that gives up, so that the others do not wait for it. */
+    void leave()
+    {
+        Mutex::Autolock l( mMutex );
+        mParties -= 1;
+        releaseLocked();
+    }
+
+    void cancel()
+    {
+        Mutex::Autolock l( mMutex );
+        mCancelled = true;
+        mCondition.broadcast();
+    }
+
+private:
+    void releaseLocked()
+    {
+        if( mWaiting > 0 && mWaiting >= mParties ) {
+            mWaiting = 0;
+            mGeneration += 1;
+            mCondition.broadcast();
+        }
+    }
+
+    Mutex       mMutex;
+    Condition   mCondition;
+    int         mParties;
+    int         mWaiting;
+    int         mGeneration;
+    bool        mCancelled;
+};
+
+class CameraContext : public Thread
+{
+public:
+    CameraContext( uint32_t id, CaptureBarrier* barrier, int shots, bool autoFocus )
+        : mId( id ), mCallbacks( &mEvents ), mBarrier( barrier ), mShots( shots ),
+          mAutoFocus( autoFocus ), mStatus( NO_INIT ), mLeft( false ) { }
+
+    status_t open( camera_module_t* module, const char* ofile )
+    {
+        mCamera = getCamera( module, mId, &mCallbacks );
+        if( mCamera == NULL ) {
+            return NO_INIT;
+        }
+        /* "/data/snapshot.jpg" becomes "/data/snapshot-cam1.jpg" and so on. */
+        const char* dot = strrchr( ofile, '.' );
+        const char* slash = strrchr( ofile, '/' );
+        if( !dot || ( slash && dot < slash ) ) {
+            dot = ofile + strlen( ofile );
+        }
+        mPath.setTo( ofile, dot - ofile );
+        mPath.appendFormat( "-cam%d%s", mId, dot );
+
+        mWriter = new ImageWriter( ImageWriter::FILE_PER_IMAGE, mPath.string() );
+        return mWriter->start();
+    }
+
+    void abort() { mEvents.post( ABORT ); }
+
+    uint32_t id() const { return mId; }
+    status_t status() const { return mStatus; }
+
+    /* Per shot: when takePicture() went out, the shutter, and the JPEG; 0 if missing. */
+    const Vector<nsecs_t>& issued() const { return mIssued; }
+    const Vector<nsecs_t>& shutters() const { return mShutters; }
+    const Vector<nsecs_t>& jpegs() const { return mJpegs; }
+
+    void getWriterStats( ImageWriter::Stats* stats ) const { mWriter->getStats( stats ); }
+
+    void release()
+    {
+        if( mWriter != NULL ) {
+            mWriter->quit();
+        }
+        if( mCamera != NULL ) {
+            mCamera->release();
+        }
+    }
+
+private:
+    virtual bool threadLoop()
+    {
+        mStatus = capture();
+        if( mStatus != OK ) {
+            LOGE( "Camera %d capture failed: %d", mId, mStatus );
+            if( !mLeft ) {
+                mBarrier->leave();
+            }
+        }
+        mCamera->stopPreview();
+        mWriter->sync();
+        fireEvent( CAMERA_DONE, mId );
+        return false;
+    }
+
+    status_t capture()
+    {
+        status_t s;
+        mCamera->setPreviewWindow( new android::CameraNativeWindow() );
+        mCamera->enableMsgType( android::CAMERA_MSG_PREVIEW_FRAME );
+        if( ( s = mCamera->startPreview() ) != OK || ( s = waitFor( PREVIEW_STARTED ) ) != OK ) {
+            return s;
+        }
+        if( mAutoFocus ) {
+            mCamera->enableMsgType( android::CAMERA_MSG_FOCUS );
+            if( ( s = mCamera->autoFocus() ) != OK || ( s = waitFor( AUTO_FOCUSED ) ) != OK ) {
+                return s;
+            }
+        }
+        mCamera->enableMsgType( android::CAMERA_MSG_SHUTTER | android::CAMERA_MSG_COMPRESSED_IMAGE );
+
+        for( int i = 0; i < mShots; i++ ) {
+            if( !mCamera->previewEnabled() && ( s = mCamera->startPreview() ) != OK ) {
+                return s;
+            }
+            mIssued.push( 0 );
+            mShutters.push( 0 );
+            mJpegs.push( 0 );
+            if( !mBarrier->arrive() ) {
+                return INVALID_OPERATION;
+            }
+            mIssued.editItemAt( i ) = systemTime( SYSTEM_TIME_MONOTONIC );
+            if( ( s = mCamera->takePicture() ) != OK ) {
+                return s;
+            }
+
+            CameraEvent event;
+            if( ( s = waitFor( IMAGE_CAPTURED, &event ) ) != OK ) {
+                return s;
+            }
+            mJpegs.editItemAt( i ) = event.timestamp;
+            mWriter->queue( event.data, event.timestamp, burstPath( mPath.string(), i, mShots ).string() );
+        }
+        /* Done with the barrier: the others must not wait for this camera's next shot. */
+        mBarrier->leave();
+        mLeft = true;
+        return OK;
+    }
+
+    /* Takes events until one of 'type', recording the shutter on the way. */
+    status_t waitFor( int type, CameraEvent* out = NULL )
+    {
+        static const nsecs_t TIMEOUT = 10000000000LL;   // 10 s
+        CameraEvent event;
+        for( ;; ) {
+            if( mEvents.waitRelative( &event, TIMEOUT ) != NO_ERROR ) {
+                LOGE( "Camera %d timed out waiting for event %d", mId, type );
+                return TIMED_OUT;
+            }
+            switch( event.type ) {
+                case ABORT:
+                    return INVALID_OPERATION;
+                case ERROR:
+                    return event.ext1 ? event.ext1 : UNKNOWN_ERROR;
+                case SHUTTER:
+                    if( !mShutters.isEmpty() && !mShutters.top() ) {
+                        mShutters.editItemAt( mShutters.size() - 1 ) = event.timestamp;
+                    }
+                    break;
+            }
+            if( event.type == type ) {
+                if( out ) {
+                    *out = event;
+                }
+                return OK;
+            }
+        }
+    }
+
+    uint32_t                        mId;
+    sp<CameraHardwareInterface_ICS> mCamera;
+    CameraEventQueue                mEvents;
+    CallbackContext                 mCallbacks;
+    sp<ImageWriter>                 mWriter;
+    String8                         mPath;
+    CaptureBarrier*                 mBarrier;
+    int                             mShots;
+    bool                            mAutoFocus;
+    status_t                        mStatus;
+    bool                            mLeft;
+    Vector<nsecs_t>                 mIssued;
+    Vector<nsecs_t>                 mShutters;
+    Vector<nsecs_t>                 mJpegs;
+};
+
+static void printSkew( FILE* out, nsecs_t skew )
+{
+    if( skew < 0 ) {
+        fprintf( out, " %16s", "-" );
+    } else {
+        fprintf( out, " %16.2f", skew / 1e6 );
+    }
+}
+
+/* The spread, max - min, of the non-zero entries at 'shot' across cameras; -1 if fewer than two. */
+static nsecs_t skewAt( const Vector< sp<CameraContext> >& cameras, const Vector<nsecs_t>& (CameraContext::*series)() const, int shot )
+{
+    nsecs_t lo = 0, hi = 0;
+    int n = 0;
+    for( size_t i = 0; i < cameras.size(); i++ ) {
+        const Vector<nsecs_t>& v = ( cameras[i].get()->*series )();
+        if( (size_t)shot >= v.size() || !v[ shot ] ) {
+            continue;
+        }
+        lo = n && lo < v[ shot ] ? lo : v[ shot ];
+        hi = n && hi > v[ shot ] ? hi : v[ shot ];
+        n += 1;
+    }
+    return n > 1 ? hi - lo : -1;
+}
+
+/*
+    Opens every camera that will open alongside the others, captures
+    'shots' pictures from all of them at once, and reports the skew
+    between them and the combined throughput.  Returns the exit status.
+*/
+static int runMultiCamera( camera_module_t* module, uint32_t count, int shots, bool autoFocus, const char* ofile )
+{
+    CaptureBarrier barrier;
+    Vector< sp<CameraContext> > cameras;
+
+    /* HALs are not always happy to open cameras concurrently, so opening is sequential. */
+    for( uint32_t id = 0; id < count; id++ ) {
+        sp<CameraContext> camera = new CameraContext( id, &barrier, shots, autoFocus );
+        status_t s = camera->open( module, ofile );
+        if( s != OK ) {
+            fprintf( stderr, "Camera %d unavailable alongside the others (%d), skipping it\n", id, s );
+            camera->release();
+            continue;
+        }
+        cameras.push( camera );
+        barrier.add();
+    }
+    if( cameras.isEmpty() ) {
+        fprintf( stderr, "No camera could be opened\n" );
+        return 1;
+    }
+
+    fprintf( stderr, "Capturing %d picture(s) from %d camera(s) at once...", shots, cameras.size() );
     fflush( stderr );
-    p.set( key, value );
-    camera->setParameters( p );
-    
-    p = camera->getParameters();
-    if( strcmp( p.get( key ), value ) == 0 ) {
-        fprintf( stderr, "OK\n" );
+    nsecs_t start = systemTime( SYSTEM_TIME_MONOTONIC );
+    for( size_t i = 0; i < cameras.size(); i++ ) {
+        char name[ 32 ];
+        snprintf( name, sizeof( name ), "snapshot-cam%d", cameras[i]->id() );
+        cameras[i]->run( name );
+    }
+
+    /* Wait for every worker, or for SIGINT. */
+    size_t done = 0;
+    while( done < cameras.size() ) {
+        CameraEvent event;
+        waitEvent( &event );
+        if( event.type == CAMERA_DONE ) {
+            done += 1;
+        } else if( event.type == ABORT ) {
+            barrier.cancel();
+            for( size_t i = 0; i < cameras.size(); i++ ) {
+                cameras[i]->abort();
+            }
+        }
+    }
+    nsecs_t elapsed = systemTime( SYSTEM_TIME_MONOTONIC ) - start;
+    fprintf( stderr, "OK\n" );
+
+    int failures = 0;
+    uint64_t bytes = 0;
+    uint32_t images = 0;
+    for( size_t i = 0; i < cameras.size(); i++ ) {
+        cameras[i]->requestExitAndWait();
+        ImageWriter::Stats stats;
+        cameras[i]->getWriterStats( &stats );
+        bytes += stats.bytes;
+        images += stats.images - stats.failures;
+        failures += stats.failures + ( cameras[i]->status() != OK );
+        fprintf( stderr, "\tcamera %d: %s, %d image(s), %llu bytes\n", cameras[i]->id(),
+            cameras[i]->status() == OK ? "OK" : "FAILED", stats.images - stats.failures, stats.bytes );
+    }
+
+    fprintf( stderr, "%-6s %16s %16s %16s\n", "shot", "issue skew ms", "shutter skew ms", "jpeg skew ms" );
+    for( int shot = 0; shot < shots; shot++ ) {
+        fprintf( stderr, "%-6d", shot );
+        printSkew( stderr, skewAt( cameras, &CameraContext::issued, shot ) );
+        printSkew( stderr, skewAt( cameras, &CameraContext::shutters, shot ) );
+        printSkew( stderr, skewAt( cameras, &CameraContext::jpegs, shot ) );
+        fprintf( stderr, "\n" );
+    }
+    fprintf( stderr, "%d image(s), %llu bytes in %.1f ms: %.2f images/s across all cameras\n",
+        images, bytes, elapsed / 1e6, elapsed ? images * 1e9 / elapsed : 0.0 );
+
+    for( size_t i = 0; i < cameras.size(); i++ ) {
+        cameras[i]->release();
+    }
+    return failures ? 1 : 0;
+}
+
+/*
+    Parameter transactions: stage any number of key changes, push them to
+    the HAL with a single setParameters(), then verify every key against one
+    read-back.  Setting keys one at a time costs a full flatten/parse round
+    trip per key.
+*/
+class ParameterTransaction
+{
+public:
+    enum { MAX_CHANGES = 32 };
+
+    ParameterTransaction() : mCount( 0 ), mStatus( NO_INIT ), mLatency( 0 ) { }
+
+    bool stage( const char* key, const char* value )
+    {
+        for( size_t i = 0; i < mCount; i++ ) {
+            if( strcmp( mChanges[i].key, key ) == 0 ) {
+                mChanges[i].value = value;
+                return true;
+            }
+        }
+        if( mCount == MAX_CHANGES ) {
+            LOGE( "Too many staged parameters, dropping '%s'", key );
+            return false;
+        }
+        mChanges[ mCount ].key = key;
+        mChanges[ mCount ].value = value;
+        mChanges[ mCount ].accepted = false;
+        mCount += 1;
         return true;
-    } else {
-        fprintf( stderr, "FAIL (%s)\n", p.get( key ) );
+    }
+
+    /* Returns OK only if the HAL took the set and every key reads back as staged. */
+    status_t apply( sp<CameraHardwareInterface_ICS> camera )
+    {
+        nsecs_t start = systemTime( SYSTEM_TIME_MONOTONIC );
+        CameraParameters p = camera->getParameters();
+
+        for( size_t i = 0; i < mCount; i++ ) {
+            p.set( mChanges[i].key, mChanges[i].value );
+        }
+        mStatus = camera->setParameters( p );
+
+        p = camera->getParameters();
+        bool all = true;
+        for( size_t i = 0; i < mCount; i++ ) {
+            const char* actual = p.get( mChanges[i].key );
+            mChanges[i].actual.setTo( actual ? actual : "(null)" );
+            mChanges[i].accepted = actual && strcmp( actual, mChanges[i].value ) == 0;
+            all = all && mChanges[i].accepted;
+        }
+        mLatency = systemTime( SYSTEM_TIME_MONOTONIC ) - start;
+
+        if( mStatus != OK ) {
+            return mStatus;
+        }
+        return all ? OK : BAD_VALUE;
+    }
+
+    void report( FILE* out ) const
+    {
+        for( size_t i = 0; i < mCount; i++ ) {
+            if( mChanges[i].accepted ) {
+                fprintf( out, "Setting '%s' to '%s'...OK\n", mChanges[i].key, mChanges[i].value );
+            } else {
+                fprintf( out, "Setting '%s' to '%s'...FAIL (%s)\n", mChanges[i].key, mChanges[i].value, mChanges[i].actual.string() );
+            }
+        }
+        fprintf( out, "Applied %d parameter(s) in %.2f ms (setParameters returned %d)\n",
+            mCount, mLatency / 1e6, mStatus );
+    }
+
+    size_t count() const { return mCount; }
+    bool accepted( size_t i ) const { return mChanges[i].accepted; }
+    nsecs_t latency() const { return mLatency; }
+
+    /*
+        True if the HAL took the set and every key read back as staged,
+        apart from those in the NULL-terminated 'except', which it may
+        have changed.
+    */
+    bool acceptedExcept( const char* const except[] ) const
+    {
+        if( mStatus != OK ) {
+            return false;
+        }
+        for( size_t i = 0; i < mCount; i++ ) {
+            if( !mChanges[i].accepted && !listed( except, mChanges[i].key ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static bool listed( const char* const keys[], const char* key )
+    {
+        for( ; *keys; keys++ ) {
+            if( strcmp( *keys, key ) == 0 ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct Change {
+        const char* key;
+        const char* value;
+        bool        accepted;
+        String8     actual;
+    };
+
+    Change      mChanges[ MAX_CHANGES ];
+    size_t      mCount;
+    status_t    mStatus;
+    nsecs_t     mLatency;
+};
+
+/*
+    Stages key=value if the camera lists value among its supported ones,
+    and complains with the list otherwise.  A camera with no list at all
+    (e.g. no flash modes on a front camera) has no such setting, so the key
+    is left alone.  Returns false only for an unsupported value.
+*/
+static bool stageSupported( ParameterTransaction& settings, const char* key, const char* value, const Vector<String8>& supported )
+{
+    if( supported.isEmpty() ) {
+        fprintf( stderr, "Camera has no '%s' setting, ignoring '%s'\n", key, value );
+        return true;
+    }
+    if( !CameraCapabilities::contains( supported, value ) ) {
+        fprintf( stderr, "Unsupported %s '%s', choose from:", key, value );
+        for( size_t i = 0; i < supported.size(); i++ ) {
+            fprintf( stderr, " %s", supported[i].string() );
+        }
+        fprintf( stderr, "\n" );
+        LOGE( "Unsupported %s '%s'", key, value );
         return false;
     }
+    return settings.stage( key, value );
+}
+
+/*
+    Checks FlatCameraParameters against CameraParameters::unflatten() on
+    captured parameter strings, one per line of 'path', and times both.
+    Also checks the generated key table against the CameraParameters KEY_
+    constants.  Returns the number of problems found.
+*/
+static int verifyFlatParser( const char* path )
+{
+    const int   iterations  = 1000;
+    FILE*       fin         = fopen( path, "rb" );
+    int         failures    = 0;
+    int         lines       = 0;
+
+#define CHECK_KEY( id ) \
+    if( strcmp( CameraParameterKey::name( CameraParameterKey::id ), CameraParameters::id ) != 0 ) { \
+        fprintf( stderr, "Key table mismatch: %s is '%s' but CameraParameters has '%s'\n", \
+            #id, CameraParameterKey::name( CameraParameterKey::id ), CameraParameters::id ); \
+        failures += 1; \
+    }
+    CAMERA_PARAMETER_KEY_CONSTANTS( CHECK_KEY )
+#undef CHECK_KEY
+
+    if( !fin ) {
+        fprintf( stderr, "Unable to open '%s': (%d) %s\n", path, errno, strerror( errno ) );
+        return 1;
+    }
+    fseek( fin, 0, SEEK_END );
+    long size = ftell( fin );
+    fseek( fin, 0, SEEK_SET );
+    char* text = (char*)malloc( size + 1 );
+    if( !text || fread( text, 1, size, fin ) != (size_t)size ) {
+        fprintf( stderr, "Unable to read '%s'\n", path );
+        fclose( fin );
+        free( text );
+        return 1;
+    }
+    fclose( fin );
+    text[ size ] = '\0';
+
+    char* line = text;
+    while( line && *line ) {
+        char* next = strchr( line, '\n' );
+        if( next ) {
+            *next++ = '\0';
+        }
+        size_t n = strlen( line );
+        if( n && line[ n - 1 ] == '\r' ) {
+            line[ --n ] = '\0';
+        }
+        if( n == 0 ) {
+            line = next;
+            continue;
+        }
+        lines += 1;
+
+        String8 str( line );
+        CameraParameters p;
+        FlatCameraParameters f;
+
+        nsecs_t start = systemTime( SYSTEM_TIME_MONOTONIC );
+        for( int i = 0; i < iterations; i++ ) {
+            p.unflatten( str );
+        }
+        nsecs_t unflattenTime = systemTime( SYSTEM_TIME_MONOTONIC ) - start;
+
+        start = systemTime( SYSTEM_TIME_MONOTONIC );
+        for( int i = 0; i < iterations; i++ ) {
+            f.parse( line );
+        }
+        nsecs_t parseTime = systemTime( SYSTEM_TIME_MONOTONIC ) - start;
+
+        /* Both flatten in key order, so equal strings mean equal contents. */
+        bool same = p.flatten() == f.flatten();
+        for( size_t i = 0; same && i < f.size(); i++ ) {
+            const char* v = p.get( f.keyAt( i ) );
+            same = v && strcmp( v, f.valueAt( i ) ) == 0;
+        }
+        for( int i = 0; same && i < CameraParameterKey::COUNT; i++ ) {
+            CameraParameterKey::Id id = CameraParameterKey::Id( i );
+            const char* v = p.get( CameraParameterKey::name( id ) );
+            const char* w = f.get( id );
+            same = v == w || ( v && w && strcmp( v, w ) == 0 );
+        }
+        if( !same ) {
+            failures += 1;
+        }
+
+        fprintf( stderr, "String %d: %d keys, %d bytes: %s; unflatten %.2f us, flat parse %.2f us (%.1fx)\n",
+            lines, f.size(), n, same ? "identical" : "MISMATCH",
+            unflattenTime / 1e3 / iterations, parseTime / 1e3 / iterations,
+            parseTime ? (double)unflattenTime / parseTime : 0.0 );
+        line = next;
+    }
+    free( text );
+
+    fprintf( stderr, "%d of %d parameter strings parsed identically\n", lines - failures, lines );
+    return failures;
+}
+
+static nsecs_t processCpuTime()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+    Runs preview in every supported size x format x fps range combination,
+    reconfiguring the open camera between them, and prints what each one
+    actually delivered over 'window' after a short warm-up.  CPU time is
+    that of this whole process, which includes the HAL's own threads.
+*/
+static void runPreviewSweep( sp<CameraHardwareInterface_ICS> camera, const sp<CameraCapabilities>& caps, nsecs_t window )
+{
+    static const nsecs_t WARMUP = 500000000LL;     // 500 ms
+
+    const Vector<Size>& sizes = caps->previewSizes();
+    const Vector<String8>& formats = caps->previewFormats();
+    const Vector<CameraCapabilities::FpsRange>& ranges = caps->previewFpsRanges();
+    /* A HAL without fps ranges still gets one pass per size and format. */
+    size_t rangeCount = ranges.isEmpty() ? 1 : ranges.size();
+
+    fprintf( stderr, "%-10s %-12s %-13s %6s %7s %7s %8s %6s %7s\n",
+        "size", "format", "fps range", "frames", "fps", "jitter", "max gap", "drops", "cpu" );
+
+    camera->enableMsgType( android::CAMERA_MSG_PREVIEW_FRAME );
+    for( size_t i = 0; i < sizes.size(); i++ ) {
+        for( size_t j = 0; j < formats.size(); j++ ) {
+            for( size_t k = 0; k < rangeCount; k++ ) {
+                /* Nothing here waits on events, so SIGINT has to be looked for. */
+                if( interrupted ) {
+                    fprintf( stderr, "Sweep interrupted\n" );
+                    camera->stopPreview();
+                    return;
+                }
+
+                char size[ 32 ];
+                char range[ 32 ] = "-";
+                snprintf( size, sizeof( size ), "%dx%d", sizes[i].width, sizes[i].height );
+
+                ParameterTransaction settings;
+                settings.stage( CameraParameters::KEY_PREVIEW_SIZE, size );
+                settings.stage( CameraParameters::KEY_PREVIEW_FORMAT, formats[j].string() );
+                nsecs_t period = 0;
+                if( !ranges.isEmpty() ) {
+                    snprintf( range, sizeof( range ), "%d,%d", ranges[k].min, ranges[k].max );
+                    settings.stage( CameraParameters::KEY_PREVIEW_FPS_RANGE, range );
+                    /* A variable range may legitimately run at its minimum, so drops are counted against that. */
+                    period = ranges[k].min > 0 ? 1000000000000LL / ranges[k].min : 0;
+                }
+
+                camera->stopPreview();
+                if( settings.apply( camera ) != OK ) {
+                    fprintf( stderr, "%-10s %-12s %-13s rejected by the HAL\n", size, formats[j].string(), range );
+                    continue;
+                }
+                if( camera->startPreview() != OK ) {
+                    fprintf( stderr, "%-10s %-12s %-13s startPreview failed\n", size, formats[j].string(), range );
+                    continue;
+                }
+
+                usleep( WARMUP / 1000 );
+                nsecs_t cpu = processCpuTime();
+                previewMeter.start( period );
+                usleep( window / 1000 );
+                previewMeter.stop();
+                cpu = processCpuTime() - cpu;
+
+                /* A window cut short by SIGINT is not worth a line. */
+                if( interrupted ) {
+                    continue;
+                }
+                previewMeter.report( stderr, size, formats[j].string(), range, (double)cpu / window );
+            }
+        }
+    }
+    camera->stopPreview();
 }
 
 int main( int argc, char* argv[] )
@@ -258,6 +1201,10 @@ int main( int argc, char* argv[] )
     const char*                     program     = basename( argv[0] );
     camera_module_t*                module;
     sp<CameraHardwareInterface_ICS> camera;
+    sp<CameraCapabilities>          caps;
+    char                            board[ PROPERTY_VALUE_MAX ];
+    String8                         fingerprint;
+    nsecs_t                         start;
     sp<ANativeWindow>               window      = new android::CameraNativeWindow();
     uint32_t                        whichOne    = android::CAMERA_FACING_BACK;
     status_t                        s;
@@ -274,16 +1221,49 @@ int main( int argc, char* argv[] )
     extern int                      optind;
     int                             c;
     bool                            autoFocus   = true;
+    int                             burst       = 1;
+    int                             cycles      = 0;
+    const char*                     jsonPath    = NULL;
+    int                             sweep       = 0;
+    bool                            allCameras  = false;
+    bool                            saveRaw     = false;
+    bool                            compressRaw = false;
+    ImageWriter::Layout             layout      = ImageWriter::FILE_PER_IMAGE;
     bool                            help        = false;
-    FILE*                           fout;
+    const char*                     verifyPath  = NULL;
     
     signal( SIGINT, handleSigInt );
     
     fprintf( stderr, "--- %s [%s %s %s] ---\n", program, __FILE__, __DATE__, __TIME__ );
     LOGD( "---------- %s [%s %s %s] ----------\n", program, __FILE__, __DATE__, __TIME__ );
     
-    while( ( c = getopt( argc, argv, ":c:e:f:hno:s:w:x:" ) ) != -1 ) {
+    while( ( c = getopt( argc, argv, ":B:b:Cc:e:f:hJ:Mno:P:rS:s:w:x:z" ) ) != -1 ) {
         switch( c ) {
+            case 'B':
+                /*
+                    Benchmark: N full focus-and-capture cycles, timing each
+                    step.  The JPEGs are not saved.
+                */
+                cycles = atoi( optarg );
+                if( cycles < 1 ) {
+                    fprintf( stderr, "Benchmark needs at least 1 cycle\n" );
+                    return 1;
+                }
+                break;
+
+            case 'b':
+                burst = atoi( optarg );
+                if( burst < 1 ) {
+                    fprintf( stderr, "Burst length must be at least 1\n" );
+                    return 1;
+                }
+                break;
+
+            case 'C':
+                /* All shots of a burst go into the -o file, one after another. */
+                layout = ImageWriter::CONTAINER;
+                break;
+
             case 'c':
                 focus = optarg;
                 break;
@@ -300,6 +1280,15 @@ int main( int argc, char* argv[] )
                 help = true;
                 break;
             
+            case 'J':
+                jsonPath = optarg;
+                break;
+
+            case 'M':
+                /* Every camera at once; -b applies to each, the parameter options do not. */
+                allCameras = true;
+                break;
+
             case 'n':
                 /*
                     Note that turning off the auto-focus, at least on ICS,
@@ -313,7 +1302,25 @@ int main( int argc, char* argv[] )
             case 'o':
                 ofile = optarg;
                 break;
+
+            case 'P':
+                verifyPath = optarg;
+                break;
             
+            case 'r':
+                /* Save the HAL's raw image of each shot next to its JPEG. */
+                saveRaw = true;
+                break;
+
+            case 'S':
+                /* Preview sweep, measuring each configuration for this many ms. */
+                sweep = atoi( optarg );
+                if( sweep < 1 ) {
+                    fprintf( stderr, "Sweep window must be at least 1 ms\n" );
+                    return 1;
+                }
+                break;
+
             case 's':
                 scene = optarg;
                 break;
@@ -325,6 +1332,11 @@ int main( int argc, char* argv[] )
             case 'x':
                 exposure = optarg;
                 break;
+
+            case 'z':
+                /* As -r, but deflated on a pool of workers while the next shot goes on. */
+                saveRaw = compressRaw = true;
+                break;
             
             case ':':
                 fprintf( stderr, "Option -%c requires an operand\n", optopt );
@@ -336,6 +1348,10 @@ int main( int argc, char* argv[] )
         }
     }
 
+    if( verifyPath ) {
+        return verifyFlatParser( verifyPath ) ? 1 : 0;
+    }
+
     if( ( s = hw_get_module( CAMERA_HARDWARE_MODULE_ID, (const hw_module_t**)&module ) ) < 0 ) {
         fprintf( stderr, "Unable to get camera module: %d\n", s );
         LOGE( "Unable to get camera module: %d", s );
@@ -352,34 +1368,82 @@ int main( int argc, char* argv[] )
     fprintf( stderr, "Number of cameras: %d\n", count );
     LOGD( "Number of cameras: %d", count );
     
-    if( ( camera = getCamera( module, whichOne ) ) == NULL ) {
+    if( allCameras ) {
+        return runMultiCamera( module, count, burst, autoFocus, ofile );
+    }
+
+    /*
+        Capabilities saved by an earlier run need no camera at all; they are
+        thrown away and rebuilt below if the HAL has changed since.
+    */
+    property_get( "ro.product.board", board, "" );
+    fingerprint = CameraCapabilities::fingerprint( &module->common );
+    start = systemTime( SYSTEM_TIME_MONOTONIC );
+    caps = CameraCapabilities::load( board, whichOne, fingerprint.string() );
+    if( caps != NULL ) {
+        fprintf( stderr, "Loaded capabilities of camera %d from cache in %.2f ms\n",
+            whichOne, ( systemTime( SYSTEM_TIME_MONOTONIC ) - start ) / 1e6 );
+    }
+    
+    if( ( camera = getCamera( module, whichOne, &mainCallbacks ) ) == NULL ) {
         fprintf( stderr, "Failed to get camera\n" );
         LOGE( "Failed to get camera" );
         return 1;
     }
     
     dumpSupportedParameters( camera, whichOne );
+    if( caps == NULL ) {
+        caps = CameraCapabilities::build( whichOne, camera->getParametersString().string() );
+        caps->save( board, whichOne, fingerprint.string() );
+    }
     
     /*
-        Set parameters from command-line options
+        Set parameters from command-line options, checking them against
+        the capabilities first so that a typo is reported by name rather
+        than as a rejected setParameters().
+
+        The scene mode goes to the HAL first, on its own: many HALs reset
+        flash, focus and the like from it, and the explicit settings should
+        win, as they did when each key was set in turn.  Should a scene
+        mode other than auto still override flash or focus after that, it
+        is reported, not fatal; every other key has to read back as set.
     */
-    if( !setParameter( camera, CameraParameters::KEY_WHITE_BALANCE, balance ) ) {
-        return 1;
-    }
-    if( !setParameter( camera, CameraParameters::KEY_EFFECT, effect ) ) {
-        return 1;
-    }
-    if( !setParameter( camera, CameraParameters::KEY_SCENE_MODE, scene ) ) {
-        return 1;
+    ParameterTransaction sceneSetting;
+    ParameterTransaction settings;
+    bool valid = true;
+    valid &= stageSupported( sceneSetting, CameraParameters::KEY_SCENE_MODE, scene, caps->sceneModes() );
+    valid &= stageSupported( settings, CameraParameters::KEY_WHITE_BALANCE, balance, caps->whiteBalances() );
+    valid &= stageSupported( settings, CameraParameters::KEY_EFFECT, effect, caps->effects() );
+    valid &= stageSupported( settings, CameraParameters::KEY_FLASH_MODE, flash, caps->flashModes() );
+    valid &= stageSupported( settings, CameraParameters::KEY_FOCUS_MODE, focus, caps->focusModes() );
+    if( atoi( exposure ) < caps->minExposureCompensation() || atoi( exposure ) > caps->maxExposureCompensation() ) {
+        fprintf( stderr, "Exposure compensation %s out of range [%d, %d]\n", exposure,
+            caps->minExposureCompensation(), caps->maxExposureCompensation() );
+        valid = false;
+    } else {
+        settings.stage( CameraParameters::KEY_EXPOSURE_COMPENSATION, exposure );
     }
-    if( !setParameter( camera, CameraParameters::KEY_FLASH_MODE, flash ) ) {
+    if( !valid ) {
         return 1;
     }
-    if( !setParameter( camera, CameraParameters::KEY_FOCUS_MODE, focus ) ) {
-        return 1;
+    if( sceneSetting.count() > 0 ) {
+        s = sceneSetting.apply( camera );
+        sceneSetting.report( stderr );
+        if( s != OK ) {
+            return 1;
+        }
     }
-    if( !setParameter( camera, CameraParameters::KEY_EXPOSURE_COMPENSATION, exposure ) ) {
-        return 1;
+    s = settings.apply( camera );
+    settings.report( stderr );
+    if( s != OK ) {
+        static const char* const sceneDriven[] = {
+            CameraParameters::KEY_FLASH_MODE, CameraParameters::KEY_FOCUS_MODE, NULL
+        };
+        bool sceneSet = sceneSetting.count() > 0 && strcmp( scene, CameraParameters::SCENE_MODE_AUTO ) != 0;
+        if( !sceneSet || !settings.acceptedExcept( sceneDriven ) ) {
+            return 1;
+        }
+        fprintf( stderr, "Scene mode '%s' overrides the flash/focus setting(s) marked FAIL above, continuing\n", scene );
     }
     
     dumpCurrentParameters( camera, whichOne );
@@ -392,6 +1456,12 @@ int main( int argc, char* argv[] )
     */
     camera->setPreviewWindow( window );
     
+    if( sweep ) {
+        runPreviewSweep( camera, caps, sweep * 1000000LL );
+        camera->release();
+        return 0;
+    }
+
     /*
         Believe it or not, you MUST call startPreview() before
         calling autoFocus(), or things just don't work.
@@ -406,89 +1476,295 @@ int main( int argc, char* argv[] )
         LOGE( "Unable to start preview: %d", s );
         return 1;
     }
+
+    /* Face detection, where supported, has to be started after preview. */
+    if( caps->maxDetectedFacesHw() > 0 ) {
+        camera->enableMsgType( android::CAMERA_MSG_PREVIEW_METADATA );
+        camera->sendCommand( CAMERA_CMD_START_FACE_DETECTION, CAMERA_FACE_DETECTION_HW, 0 );
+    }
    
+    sp<CommandThread> commands = new CommandThread( camera );
+    commands->setErrorCallback( snapshot_command_error, &mainCallbacks );
+    commands->run( "snapshot-commands" );
+
+    sp<ImageWriter> writer = new ImageWriter( layout, ofile );
+    if( ( s = writer->start() ) != OK ) {
+        fprintf( stderr, "Unable to create '%s': %d\n", ofile, s );
+        return 1;
+    }
+
+    /*
+        Raw images always get a file each, even with -C, so they get a
+        writer of their own; compressed ones go to the RawCompressor, which
+        writes its own files.
+    */
+    sp<ImageWriter> rawWriter;
+    RawCompressor* compressor = NULL;
+    if( saveRaw && !cycles ) {
+        if( compressRaw ) {
+            compressor = new RawCompressor();
+            s = compressor->start();
+        } else {
+            rawWriter = new ImageWriter( ImageWriter::FILE_PER_IMAGE, ofile );
+            s = rawWriter->start();
+        }
+        if( s != OK ) {
+            fprintf( stderr, "Unable to start the raw image writer: %d\n", s );
+            return 1;
+        }
+    }
+    int raws = 0;
+
+    /* Burst bookkeeping: when each takePicture() went out, and how long its JPEG took. */
+    int shots = 0;
+    Vector< sp<CameraCommandResult> > restarts;
+    nsecs_t requestedAt = 0;
+    nsecs_t shutterAt = 0;
+    nsecs_t burstStart = 0;
+    nsecs_t burstEnd = 0;
+    Vector<nsecs_t> latencies;
+
+    /* Benchmark bookkeeping, one entry per completed cycle. */
+    Vector<CaptureTiming> timings;
+    CaptureTiming timing;
+    memset( &timing, 0, sizeof( timing ) );
+    sp<CameraCommandResult> focusCommand;
+    sp<CameraCommandResult> takeCommand;
+
     /* Events are injected by calling fireEvent(), above. */
     LOGD( "----- Entering event loop -----" );
     bool exit = false;
     while( !exit ) {
-        switch( event ) {
-            case NO_EVENT:
-                pthread_mutex_lock( &lock );
-                pthread_cond_wait( &cond, &lock );
-                LOGD( "Got event %d", event );
-                continue;
-            
+        CameraEvent event;
+        waitEvent( &event );
+        LOGD( "Got event %d", event.type );
+
+        switch( event.type ) {
             case ABORT:
                 exit = true;
                 break;
             
             case PREVIEW_STARTED:
+                if( cycles ) {
+                    camera->enableMsgType( android::CAMERA_MSG_SHUTTER | android::CAMERA_MSG_RAW_IMAGE_NOTIFY |
+                        android::CAMERA_MSG_COMPRESSED_IMAGE );
+                    fprintf( stderr, "OK\nRunning %d capture cycle(s)...", cycles );
+                    fflush( stderr );
+                }
                 if( autoFocus ) {
                     camera->enableMsgType( android::CAMERA_MSG_FOCUS );
-                    fprintf( stderr, "OK\nStarting autofocus..." );
-                    LOGD( "Starting autofocus..." );
-                    fflush( stderr );
-                    if( ( s = camera->autoFocus() ) != OK ) {
-                        fprintf( stderr, "failure (%d)\n", s );
-                        LOGE( "Autofocus failed: %d", s );
-                        return 1;
+                    if( !cycles ) {
+                        fprintf( stderr, "OK\nStarting autofocus..." );
+                        LOGD( "Starting autofocus..." );
+                        fflush( stderr );
                     }
+                    focusCommand = commands->autoFocus();
                     break;
                 }
                 // fallthrough if autoFocus is not set
             
             case AUTO_FOCUSED:
-                camera->enableMsgType( android::CAMERA_MSG_COMPRESSED_IMAGE );
-                fprintf( stderr, "OK\nTaking picture..." );
-                LOGD( "Taking picture..." );
-                fflush( stderr );
-                if( ( s = camera->takePicture() ) != OK ) {
-                    fprintf( stderr, "failure (%d)\n", s );
-                    LOGE( "Take picture failed: %d", s );
-                    return 1;
+                if( cycles ) {
+                    if( event.type == AUTO_FOCUSED ) {
+                        timing.focused = event.timestamp;
+                    }
+                    takeCommand = commands->takePicture();
+                    break;
+                }
+                camera->enableMsgType( android::CAMERA_MSG_SHUTTER | android::CAMERA_MSG_COMPRESSED_IMAGE );
+                if( saveRaw ) {
+                    camera->enableMsgType( android::CAMERA_MSG_RAW_IMAGE );
                 }
+                fprintf( stderr, "OK\nTaking %d picture(s)...", burst );
+                LOGD( "Taking %d picture(s)...", burst );
+                fflush( stderr );
+                requestedAt = burstStart = systemTime( SYSTEM_TIME_MONOTONIC );
+                commands->takePicture();
                 break;
             
-            case IMAGE_CAPTURED:
-                // save picture and exit
-                fprintf( stderr, "OK\nSaving to '%s'...", ofile );
-                LOGD( "Image captured, saving to %s", ofile );
-                fflush( stderr );
-                fout = fopen( ofile, "wb" );
-                if( fout ) {
-                    size_t n = fwrite( (const void*)data, length, 1, fout );
-                    if( n == 1 ) {
-                        fprintf( stderr, "wrote %d bytes\n", length );
-                        fclose( fout );
+            case SHUTTER:
+                if( !timing.shutter ) {
+                    timing.shutter = event.timestamp;
+                }
+                shutterAt = event.timestamp;
+                LOGD( "Shutter %.1f ms after takePicture", ( shutterAt - requestedAt ) / 1e6 );
+                break;
+
+            case RAW_CAPTURED:
+                if( !timing.raw ) {
+                    timing.raw = event.timestamp;
+                }
+                LOGD( "Raw image %.1f ms after shutter", ( event.timestamp - shutterAt ) / 1e6 );
+
+                /*
+                    Only CAMERA_MSG_RAW_IMAGE carries the buffer; the raw
+                    image of shot N arrives before its JPEG, so shots is
+                    still N.
+                */
+                if( event.data != NULL && ( rawWriter != NULL || compressor ) ) {
+                    String8 path = rawPath( ofile, shots, burst, compressor != NULL );
+                    LOGD( "Raw image %d, %d bytes, saving to %s", shots, event.data->size(), path.string() );
+                    if( compressor ) {
+                        compressor->compress( event.data, path.string() );
                     } else {
-                        LOGE( "fwrite() returned %d: (%d) %s", n, errno, strerror( errno ) );
-                        fprintf( stderr, "FAIL: (%d) %s\n", errno, strerror( errno ) );
-                        return 1;
+                        rawWriter->queue( event.data, event.timestamp, path.string() );
                     }
-                } else {
-                    fprintf( stderr, "FAIL: (%d) %s\n", errno, strerror( errno ) );
-                    return 1;
+                    event.data.clear();
+                    raws += 1;
                 }
-                exit = true;
                 break;
+
+            case IMAGE_CAPTURED: {
+                if( cycles ) {
+                    event.data.clear();
+                    timing.focusIssued = focusCommand != NULL ? focusCommand->startTime() : 0;
+                    timing.takeIssued = takeCommand != NULL ? takeCommand->startTime() : 0;
+                    timing.jpeg = event.timestamp;
+                    timings.push( timing );
+                    focusCommand.clear();
+                    takeCommand.clear();
+                    memset( &timing, 0, sizeof( timing ) );
+                    if( (int)timings.size() == cycles ) {
+                        exit = true;
+                        break;
+                    }
+
+                    /* Next cycle: preview back on if need be, then focus again. */
+                    commands->ensurePreview();
+                    if( autoFocus ) {
+                        focusCommand = commands->autoFocus();
+                    } else {
+                        takeCommand = commands->takePicture();
+                    }
+                    break;
+                }
+
+                // hand the picture to the writer, then take the next one or exit
+                String8 path = burstPath( ofile, shots, burst );
+                LOGD( "Image %d captured, saving to %s", shots, path.string() );
+                writer->queue( event.data, event.timestamp, path.string() );
+                event.data.clear();
+                latencies.push( event.timestamp - requestedAt );
+                burstEnd = event.timestamp;
+                shots += 1;
+                if( shots == burst ) {
+                    exit = true;
+                    break;
+                }
+
+                /*
+                    Most HALs stop preview to take a picture, and some need
+                    it running again before the next one.
+                */
+                requestedAt = systemTime( SYSTEM_TIME_MONOTONIC );
+                restarts.push( commands->ensurePreview() );
+                commands->takePicture();
+                break;
+            }
             
             case ERROR:
-                fprintf( stderr, "An error occured--check logcat\n" );
+                fprintf( stderr, "An error occured (%d)--check logcat\n", event.ext1 );
                 return 1;
             
             default:
-                fprintf( stderr, "Weird, unhandled event %d\n", event );
+                fprintf( stderr, "Weird, unhandled event %d\n", event.type );
                 break;
         }
-        
-        event = NO_EVENT;
-        pthread_mutex_unlock( &lock );
     }
     LOGD( "----- Leaving event loop -----" );
 
-    camera->stopPreview();
-    camera->release();
+    int failures = 0;
+    if( cycles && timings.size() > 0 ) {
+        fprintf( stderr, "OK\n%d of %d cycle(s) completed\n", timings.size(), cycles );
+        FILE* json = NULL;
+        if( jsonPath ) {
+            json = strcmp( jsonPath, "-" ) ? fopen( jsonPath, "w" ) : stdout;
+            if( !json ) {
+                fprintf( stderr, "Unable to create '%s': (%d) %s\n", jsonPath, errno, strerror( errno ) );
+                failures += 1;
+            }
+        }
+        reportBenchmark( timings, stderr, json, board, whichOne );
+        if( json && json != stdout ) {
+            fclose( json );
+        }
+    }
+    if( shots > 0 ) {
+        fprintf( stderr, "OK\nWaiting for %d picture(s) to be written...", shots );
+        fflush( stderr );
+        failures = writer->sync();
+        ImageWriter::Stats stats;
+        writer->getStats( &stats );
+        fprintf( stderr, "%s\n", failures ? "FAIL" : "OK" );
+        fprintf( stderr, "Wrote %llu bytes in %.1f ms (%.1f MB/s), fsync %.1f ms, %d copied in the kernel, queue depth max %d\n",
+            stats.bytes, stats.writeTime / 1e6,
+            stats.writeTime ? stats.bytes * 1e3 / stats.writeTime : 0.0,
+            stats.syncTime / 1e6, stats.kernelCopies, stats.maxQueueDepth );
+
+        /* Every restart check ran before the takePicture() behind it, so all are done. */
+        int restarted = 0;
+        for( size_t i = 0; i < restarts.size(); i++ ) {
+            restarted += restarts[i]->value();
+        }
+
+        nsecs_t total = 0, fastest = latencies[0], slowest = latencies[0];
+        for( size_t i = 0; i < latencies.size(); i++ ) {
+            fprintf( stderr, "\tshot %d: %.1f ms\n", i, latencies[i] / 1e6 );
+            total += latencies[i];
+            fastest = latencies[i] < fastest ? latencies[i] : fastest;
+            slowest = latencies[i] > slowest ? latencies[i] : slowest;
+        }
+        fprintf( stderr, "%d shot(s) in %.1f ms: %.2f shots/s sustained, latency min %.1f / avg %.1f / max %.1f ms, %d preview restart(s)\n",
+            shots, ( burstEnd - burstStart ) / 1e6,
+            burstEnd > burstStart ? shots * 1e9 / ( burstEnd - burstStart ) : 0.0,
+            fastest / 1e6, total / 1e6 / shots, slowest / 1e6, restarted );
+    }
+    if( saveRaw && !cycles && raws == 0 ) {
+        fprintf( stderr, "No raw image data was delivered; this HAL may only notify of raw captures\n" );
+    }
+    if( rawWriter != NULL && raws > 0 ) {
+        fprintf( stderr, "Waiting for %d raw image(s) to be written...", raws );
+        fflush( stderr );
+        int rawFailures = rawWriter->sync();
+        ImageWriter::Stats stats;
+        rawWriter->getStats( &stats );
+        fprintf( stderr, "%s\n", rawFailures ? "FAIL" : "OK" );
+        fprintf( stderr, "Wrote %llu raw bytes in %.1f ms (%.1f MB/s)\n",
+            stats.bytes, stats.writeTime / 1e6,
+            stats.writeTime ? stats.bytes * 1e3 / stats.writeTime : 0.0 );
+        failures += rawFailures;
+    }
+    if( rawWriter != NULL ) {
+        rawWriter->quit();
+    }
+    if( compressor && raws > 0 ) {
+        fprintf( stderr, "Waiting for %d raw image(s) to be compressed...", raws );
+        fflush( stderr );
+        int rawFailures = compressor->wait();
+        RawCompressor::Stats stats;
+        compressor->getStats( &stats );
+        fprintf( stderr, "%s\n", rawFailures ? "FAIL" : "OK" );
+        fprintf( stderr, "Compressed %llu raw bytes to %llu (%.1f%%), %.1f MB/s per worker, %.1f ms per image\n",
+            stats.rawBytes, stats.storedBytes,
+            stats.rawBytes ? stats.storedBytes * 100.0 / stats.rawBytes : 0.0,
+            stats.busyTime ? stats.rawBytes * 1e3 / stats.busyTime : 0.0,
+            stats.images ? stats.wallTime / 1e6 / stats.images : 0.0 );
+        failures += rawFailures;
+    }
+    delete compressor;
+    writer->quit();
+
+    /* Both are queued at once; only the last one needs waiting for. */
+    commands->stopPreview();
+    sp<CameraCommandResult> released = commands->release();
+    released->wait();
+    LOGD( "Stopped and released in %.2f ms", released->latency() / 1e6 );
+    commands->quit();
+
+#if CAMERA_TRACE_LEVEL > CAMERA_TRACE_NONE
+    CameraTrace::dump( stderr );
+#endif
     
     LOGD( "Done." );
-    return 0;
+    return failures ? 1 : 0;
 }